@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,45 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a one-shot countdown of COUNT PIT cycles on channel 0,
+   which raises interrupt line 0 once when it reaches zero (mode
+   0).  Counting starts as soon as the count is written.  This
+   replaces the periodic mode set by pit_configure_channel(),
+   which must be called again to restore it. */
+void
+pit_start_oneshot (uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (count > 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), count);
+  outb (PIT_PORT_COUNTER (0), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current count of channel 0 and, if OUT is nonnull,
+   stores the state of its output in *OUT.  In mode 0 the output
+   goes high when the count reaches zero. */
+uint16_t
+pit_read_counter (bool *out)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  /* Read-back command: latch both status and count of channel
+     0, which then read out status first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc2);
+  status = inb (PIT_PORT_COUNTER (0));
+  lo = inb (PIT_PORT_COUNTER (0));
+  hi = inb (PIT_PORT_COUNTER (0));
+  intr_set_level (old_level);
+
+  if (out != NULL)
+    *out = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -20,11 +21,72 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Threads sleeping in timer_sleep(), in order of increasing
+   wakeup_tick.  Threads with the same wakeup tick are kept in the
+   order they went to sleep. */
+static struct list sleep_list;
+
+/* Callback timers are kept in a hierarchical timing wheel of
+   WHEEL_LEVELS levels of WHEEL_SIZE slots each.  A timer due
+   within WHEEL_SIZE ticks sits in the level-0 slot for its
+   expiry tick; one due within WHEEL_SIZE**2 ticks sits in a
+   level-1 slot that covers WHEEL_SIZE ticks, and so on.  Each
+   tick, timer_interrupt() moves the timers in one level-0 slot
+   to expired_timers.  Every WHEEL_SIZE ticks it also "cascades"
+   one slot of the next level up, re-inserting its timers into
+   the levels below.  Adding and canceling a timer are O(1), and
+   the work per tick does not grow with the number of pending
+   timers.
+
+   Callbacks do not run in the interrupt handler: the timer
+   thread runs them with interrupts on, much like a softirq. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/* Timers further out than this many ticks are parked in the top
+   level and re-inserted when it cascades. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+/* The wheel, its position, and the timers that have expired but
+   not yet run.  Protected by disabling interrupts. */
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static int64_t wheel_tick;              /* Next tick to expire. */
+static struct list expired_timers;
+static struct semaphore expired_sema;   /* Upped when timers expire. */
+static int64_t timers_run;              /* Callbacks run. */
+
+/* PIT cycles in one timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest stretch the 16-bit PIT counter can time, in ticks. */
+#define NOHZ_MAX_TICKS (UINT16_MAX / TICK_CYCLES)
+
+/* Tickless idle: if true, the idle thread stops the periodic
+   tick and has the PIT fire once at the next tick on which
+   something is due (see timer_nohz_enter()).  Set by the -nohz
+   option. */
+bool timer_nohz;
+
+/* Ticks up to and including the one at which the armed one-shot
+   fires, or 0 while the PIT is periodic. */
+static int64_t nohz_ticks;
+static int64_t nohz_skipped;            /* Ticks not interrupted. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static bool wakeup_less (const struct list_elem *, const struct list_elem *,
+                         void *aux);
+static void init_wheel (void);
+static int64_t next_deadline (void);
+static void nohz_catch_up (int64_t skipped);
+static void wheel_insert (struct timer *);
+static void wheel_advance (void);
+static thread_func timer_thread;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -36,9 +98,19 @@ void
 timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleep_list);
+  init_wheel ();
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
+/* Starts the thread that runs expired timers' callbacks.  Must
+   be called after thread_start(). */
+void
+timer_start (void)
+{
+  thread_create ("timer", PRI_MAX, timer_thread, NULL);
+}
+
 /* Calibrates loops_per_tick, used to implement brief delays. */
 void
 timer_calibrate (void)
@@ -85,15 +157,25 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks on sleep_list until timer_interrupt() wakes
+   it, instead of staying on the ready list. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_list, &cur->elem, wakeup_less, NULL);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -159,21 +241,334 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Initializes timer T to call FUNC with AUX when it expires. */
+void
+timer_setup (struct timer *t, timer_func *func, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->pending = false;
+}
+
+/* Arms timer T to expire in about TICKS timer ticks, or at the
+   next tick if TICKS is not positive.  T must not be pending.
+   May be called from an interrupt handler or a timer callback,
+   including T's own. */
+void
+timer_add (struct timer *t, int64_t ticks)
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!t->pending);
+  t->expires = timer_ticks () + ticks;
+  t->pending = true;
+  wheel_insert (t);
+  intr_set_level (old_level);
+}
+
+/* Disarms timer T.  Returns true if T was pending, false if it
+   had already run or was never added.  T's callback may still be
+   running in the timer thread when this returns. */
+bool
+timer_cancel (struct timer *t)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  was_pending = t->pending;
+  if (was_pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+  return was_pending;
+}
+
+/* Returns true if timer T is armed and has not yet run. */
+bool
+timer_pending (const struct timer *t)
+{
+  return t->pending;
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void)
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" timer callbacks, "
+          "%"PRId64" ticks skipped while idle\n",
+          timer_ticks (), timers_run, nohz_skipped);
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts.  If nothing is due at the next tick, replaces the
+   periodic tick by a one-shot that fires at the next tick on
+   which a sleeper wakes, a timer expires, the timing wheel
+   cascades or (under MLFQS) a second ends, or as far ahead as
+   the PIT can count.  The one-shot is aligned to where the
+   periodic tick would have fired, so time does not drift. */
+void
+timer_nohz_enter (void)
+{
+  int64_t idle;
+  uint16_t first;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_nohz || nohz_ticks > 0)
+    return;
+  idle = next_deadline () - ticks;
+  if (idle < 2)
+    return;
+
+  /* Cycles left until the periodic tick would have fired.  If it
+     is about to, let it: it might fire before the one-shot is
+     armed and be counted twice. */
+  first = pit_read_counter (NULL);
+  if (first < TICK_CYCLES / 16 || first > TICK_CYCLES)
+    return;
+
+  nohz_ticks = idle;
+  pit_start_oneshot (first + (idle - 1) * TICK_CYCLES);
+}
+
+/* Called with interrupts off when the idle thread wakes up or is
+   switched away from.  If the one-shot armed by
+   timer_nohz_enter() has not fired, brings the tick count up to
+   date and rearms it to fire at the next tick boundary, where
+   timer_interrupt() restores the periodic tick. */
+void
+timer_nohz_exit (void)
+{
+  int64_t left;
+  uint16_t count;
+  bool fired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (nohz_ticks == 0)
+    return;
+  count = pit_read_counter (&fired);
+  if (fired)
+    return;                     /* timer_interrupt() is pending. */
+
+  /* Tick boundaries still ahead of the one-shot, and cycles to
+     the nearest. */
+  left = DIV_ROUND_UP (count, TICK_CYCLES);
+  nohz_catch_up (nohz_ticks - left);
+  nohz_ticks = 1;
+  pit_start_oneshot (count - (left - 1) * TICK_CYCLES);
+}
+
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
+  bool fired;
+
+  /* If the tickless one-shot fired, account for the ticks it
+     covered and go back to a periodic tick.  (A periodic tick
+     that was already pending when the one-shot was armed also
+     lands here, and counts as an ordinary tick.) */
+  if (nohz_ticks > 0)
+    {
+      pit_read_counter (&fired);
+      if (fired)
+        {
+          nohz_catch_up (nohz_ticks - 1);
+          nohz_ticks = 0;
+          pit_configure_channel (0, 2, TIMER_FREQ);
+        }
+    }
+
   ticks++;
+
+  /* Wake the threads whose time has come.  Only the front of
+     sleep_list needs to be checked. */
+  while (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wakeup_tick > ticks)
+        break;
+      list_pop_front (&sleep_list);
+      thread_unblock (t);
+    }
+
+  profile_sample (args);
+  wheel_advance ();
   thread_tick ();
 }
 
+/* Returns the next tick at which timer_interrupt() has work to
+   do, or at most NOHZ_MAX_TICKS ahead.  Interrupts must be off. */
+static int64_t
+next_deadline (void)
+{
+  int64_t deadline = ticks + NOHZ_MAX_TICKS;
+  int64_t t;
+
+  if (!list_empty (&sleep_list))
+    {
+      struct thread *s = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (s->wakeup_tick < deadline)
+        deadline = s->wakeup_tick;
+    }
+
+  /* Level-0 slots hold timers due within WHEEL_SIZE ticks; the
+     start of a lap may cascade more into them. */
+  for (t = wheel_tick; t < deadline; t++)
+    if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+      {
+        deadline = t;
+        break;
+      }
+
+  if (thread_mlfqs && ROUND_UP (ticks + 1, TIMER_FREQ) < deadline)
+    deadline = ROUND_UP (ticks + 1, TIMER_FREQ);
+  return deadline;
+}
+
+/* Advances the tick count by SKIPPED ticks that passed, all of
+   them idle, without a timer interrupt.  The timer interrupt
+   that follows catches up on sleepers and the timing wheel. */
+static void
+nohz_catch_up (int64_t skipped)
+{
+  ticks += skipped;
+  nohz_skipped += skipped;
+  thread_account_idle (skipped);
+}
+
+/* Initializes the timing wheel. */
+static void
+init_wheel (void)
+{
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&expired_timers);
+  sema_init (&expired_sema, 0);
+}
+
+/* Puts pending timer T into the wheel slot for its expiry tick.
+   Interrupts must be off. */
+static void
+wheel_insert (struct timer *t)
+{
+  int64_t expires = t->expires;
+  int64_t delta = expires - wheel_tick;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    {
+      /* Already due: expire at the next tick processed. */
+      expires = wheel_tick;
+      delta = 0;
+    }
+  else if (delta >= WHEEL_SPAN)
+    {
+      expires = wheel_tick + WHEEL_SPAN - 1;
+      delta = WHEEL_SPAN - 1;
+    }
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &t->elem);
+}
+
+/* Brings the wheel up to the current tick, moving timers that
+   are due to expired_timers and waking the timer thread if there
+   are any.  Called from the timer interrupt. */
+static void
+wheel_advance (void)
+{
+  bool expired = false;
+
+  for (; wheel_tick <= ticks; wheel_tick++)
+    {
+      struct list *slot = &wheel[0][wheel_tick & WHEEL_MASK];
+      size_t idx = wheel_tick & WHEEL_MASK;
+      int level;
+
+      /* At the start of each lap of a level, spread the next slot
+         of the level above over the levels below. */
+      for (level = 1; idx == 0 && level < WHEEL_LEVELS; level++)
+        {
+          struct list *upper;
+
+          idx = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+          upper = &wheel[level][idx];
+          while (!list_empty (upper))
+            wheel_insert (list_entry (list_pop_front (upper),
+                                      struct timer, elem));
+        }
+
+      if (!list_empty (slot))
+        {
+          list_splice (list_end (&expired_timers),
+                       list_begin (slot), list_end (slot));
+          expired = true;
+        }
+    }
+
+  if (expired)
+    sema_up (&expired_sema);
+}
+
+/* Runs the callbacks of expired timers. */
+static void
+timer_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&expired_sema);
+
+      intr_disable ();
+      while (!list_empty (&expired_timers))
+        {
+          struct timer *t = list_entry (list_pop_front (&expired_timers),
+                                        struct timer, elem);
+          t->pending = false;
+          timers_run++;
+          intr_enable ();
+
+          t->func (t->aux);
+
+          intr_disable ();
+        }
+      intr_enable ();
+    }
+}
+
+/* Returns true if the thread owning A wakes before the one
+   owning B. */
+static bool
+wakeup_less (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->wakeup_tick
+          < list_entry (b, struct thread, elem)->wakeup_tick);
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
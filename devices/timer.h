@@ -1,13 +1,16 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
 void timer_init (void);
+void timer_start (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
@@ -24,6 +27,29 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Callback timers.  FUNC runs with AUX in the timer thread,
+   with interrupts on, once the timer expires.  See timer.c. */
+typedef void timer_func (void *aux);
+
+struct timer
+  {
+    struct list_elem elem;      /* In a wheel slot or expired list. */
+    int64_t expires;            /* Tick at which to expire. */
+    timer_func *func;           /* Callback. */
+    void *aux;                  /* Callback argument. */
+    bool pending;               /* Added and not yet run or canceled. */
+  };
+
+void timer_setup (struct timer *, timer_func *, void *aux);
+void timer_add (struct timer *, int64_t ticks);
+bool timer_cancel (struct timer *);
+bool timer_pending (const struct timer *);
+
+/* Tickless idle. */
+extern bool timer_nohz;
+void timer_nohz_enter (void);
+void timer_nohz_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -5,7 +5,7 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 
 /* Identifies an inode. */
@@ -51,6 +51,11 @@ struct inode
     struct lock lock_inode;
   };
 
+/* Cache of in-memory inodes, and of sector-sized buffers for
+   on-disk inodes, indirect blocks and bounce buffers. */
+static struct kmem_cache inode_cache;
+static struct kmem_cache sector_cache;
+
 static bool inode_allocate(struct inode_disk *inoded, off_t length);
 static void inode_deallocate(struct inode_disk *inoded);
 
@@ -93,11 +98,11 @@ static block_sector_t _byte_to_sector(const struct inode_disk * inoded, off_t se
    for (int i=0; i<NUM_OF_INDIRECT_POINTER; i++) {
       sector_limit += INDIRECT_POINTERS_PRE_SECTOR * 1;  // each indirect pointer creates INDIRECT_POINTERS_PRE_SECTOR number of sectors available for file data
       if (sector_idx < sector_limit) {
-         struct inode_indirect_pointer *indptr = malloc(sizeof(struct inode_indirect_pointer));
+         struct inode_indirect_pointer *indptr = kmem_cache_alloc(&sector_cache);
          block_read (fs_device, inoded->indirect_pointer[i], indptr);
          off_t indirect_offset = sector_idx - cur_base;  // the nth pointer in the region pointed by this indirect pointer
          block_sector_t ret = indptr->sector_ptr[indirect_offset]; // returned is the sector num of the file data sector
-         free(indptr);
+         kmem_cache_free(&sector_cache, indptr);
          return ret;
       }
       cur_base = sector_limit;
@@ -106,15 +111,15 @@ static block_sector_t _byte_to_sector(const struct inode_disk * inoded, off_t se
    // now move on to double indirect pointer
    sector_limit += INDIRECT_POINTERS_PRE_SECTOR * 1 * INDIRECT_POINTERS_PRE_SECTOR * 1;
    if (sector_idx < sector_limit) {
-      struct inode_indirect_pointer *level1ptr = malloc(sizeof(struct inode_indirect_pointer));
-      struct inode_indirect_pointer *level2ptr = malloc(sizeof(struct inode_indirect_pointer));
+      struct inode_indirect_pointer *level1ptr = kmem_cache_alloc(&sector_cache);
+      struct inode_indirect_pointer *level2ptr = kmem_cache_alloc(&sector_cache);
       block_read (fs_device, inoded->double_indirect_pointer, level1ptr);
       off_t first_level_off = (sector_idx - cur_base) / INDIRECT_POINTERS_PRE_SECTOR;
       block_read (fs_device, level1ptr->sector_ptr[first_level_off], level2ptr);
       off_t second_level_off = (sector_idx - cur_base) % INDIRECT_POINTERS_PRE_SECTOR;
       block_sector_t ret = level2ptr->sector_ptr[second_level_off];
-      free(level1ptr);
-      free(level2ptr);
+      kmem_cache_free(&sector_cache, level1ptr);
+      kmem_cache_free(&sector_cache, level2ptr);
       return ret;
    }
 
@@ -126,14 +131,31 @@ static block_sector_t _byte_to_sector(const struct inode_disk * inoded, off_t se
 
 
 /* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
+   returns the same `struct inode'.  Lookups hold open_inodes_lock
+   for reading, adding or removing an inode holds it for
+   writing. */
 static struct list open_inodes;
+static struct rwlock open_inodes_lock;
+
+static struct inode *find_open_inode (block_sector_t sector);
+
+/* Constructs a `struct inode' for inode_cache.  Its lock is
+   released whenever it is freed, so it is initialized only once. */
+static void
+inode_ctor (void *inode_)
+{
+  struct inode *inode = inode_;
+  lock_init (&inode->lock_inode);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
   list_init (&open_inodes);
+  rwlock_init (&open_inodes_lock, false);
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), inode_ctor);
+  kmem_cache_init (&sector_cache, "sector", BLOCK_SECTOR_SIZE, NULL);
 }
 
 /*
@@ -153,8 +175,9 @@ bool inode_create (block_sector_t sector, off_t length, bool is_dir) {
    one sector in size, and you should fix that. */
    ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-   disk_inode = calloc (1, sizeof *disk_inode);
+   disk_inode = kmem_cache_alloc (&sector_cache);
    if (disk_inode != NULL) {
+      memset (disk_inode, 0, sizeof *disk_inode);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = is_dir;
@@ -162,7 +185,7 @@ bool inode_create (block_sector_t sector, off_t length, bool is_dir) {
          block_write (fs_device, sector, disk_inode);
          success = true;
       }
-      free (disk_inode);
+      kmem_cache_free (&sector_cache, disk_inode);
    }
    return success;
 }
@@ -174,37 +197,58 @@ bool inode_create (block_sector_t sector, off_t length, bool is_dir) {
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *open;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
-    }
+  rwlock_read_acquire (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  rwlock_read_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  lock_init (&inode->lock_inode);
   block_read (fs_device, inode->sector, &inode->data);
+
+  /* Another thread may have opened it while we were reading. */
+  rwlock_write_acquire (&open_inodes_lock);
+  open = find_open_inode (sector);
+  if (open == NULL)
+    list_push_front (&open_inodes, &inode->elem);
+  rwlock_write_release (&open_inodes_lock);
+  if (open != NULL)
+    {
+      kmem_cache_free (&inode_cache, inode);
+      return open;
+    }
   return inode;
 }
 
+/* Returns the open inode for SECTOR, reopened, or a null pointer
+   if SECTOR is not open.  open_inodes_lock must be held. */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector)
+        return inode_reopen (inode);
+    }
+  return NULL;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
@@ -228,24 +272,34 @@ inode_get_inumber (const struct inode *inode)
    If INODE was also a removed inode, frees its blocks.
 */
 void inode_close (struct inode *inode) {
+   bool last;
+
    /* Ignore null pointer. */
    if (inode == NULL) return;
 
+   /* Only the last close needs the open inodes list, which keeps
+      inode_open() from reopening INODE as we free it. */
    lock_acquire (&inode->lock_inode);
-   inode->open_cnt--;
+   last = inode->open_cnt == 1;
+   if (!last) inode->open_cnt--;
    lock_release (&inode->lock_inode);
+   if (!last) return;
 
-   /* Release resources if this was the last opener. */
-   if (inode->open_cnt == 0) {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+   rwlock_write_acquire (&open_inodes_lock);
+   lock_acquire (&inode->lock_inode);
+   last = --inode->open_cnt == 0;
+   lock_release (&inode->lock_inode);
+   if (last) list_remove (&inode->elem);
+   rwlock_write_release (&open_inodes_lock);
 
+   /* Release resources if this was the last opener. */
+   if (last) {
       /* Deallocate blocks if removed. */
       if (inode->removed) {
          free_map_release (inode->sector, 1);
          inode_deallocate(&inode->data);
       }
-      free (inode);
+      kmem_cache_free (&inode_cache, inode);
    }
 }
 
@@ -297,7 +351,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
              into caller's buffer. */
           if (bounce == NULL)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
+              bounce = kmem_cache_alloc (&sector_cache);
               if (bounce == NULL)
                 break;
             }
@@ -310,7 +364,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  if (bounce != NULL) free (bounce);
+  kmem_cache_free (&sector_cache, bounce);
 
   return bytes_read;
 }
@@ -375,7 +429,7 @@ off_t inode_write_at (struct inode *inode, const void *buffer_, off_t size, off_
          /* We need a bounce buffer. */
          if (bounce == NULL)
          {
-            bounce = malloc (BLOCK_SECTOR_SIZE);
+            bounce = kmem_cache_alloc (&sector_cache);
             if (bounce == NULL)
             break;
          }
@@ -395,7 +449,7 @@ off_t inode_write_at (struct inode *inode, const void *buffer_, off_t size, off_
       offset += chunk_size;
       bytes_written += chunk_size;
    }
-   if (bounce != NULL) free (bounce);
+   kmem_cache_free (&sector_cache, bounce);
 
    return bytes_written;
 }
@@ -459,20 +513,20 @@ static bool inode_allocate(struct inode_disk *inoded, off_t length) {
          return false;
       // if the indirect pointer is already allocated, still possibly the next-level direct pointers are not pointing to meaningful sector.
       // read the sector storing all next-level direct pointers into local indptr
-      struct inode_indirect_pointer *indptr = malloc(sizeof(struct inode_indirect_pointer));  // we implemented stack growth so hopefully this is fine
+      struct inode_indirect_pointer *indptr = kmem_cache_alloc(&sector_cache);  // we implemented stack growth so hopefully this is fine
       block_read (fs_device, inoded->indirect_pointer[i], indptr);
 
       n = num_of_sectors < INDIRECT_POINTERS_PRE_SECTOR ? num_of_sectors : INDIRECT_POINTERS_PRE_SECTOR;
       // then start assigning data sector to those direct pointers
       for (off_t j=0; j<n; j++) {
          if (!_inode_allocate(&indptr->sector_ptr[j])) {
-            free(indptr);
+            kmem_cache_free(&sector_cache, indptr);
             return false;
          }
       }
       // then write content in local indptr to filesys
       block_write(fs_device, inoded->indirect_pointer[i], indptr);
-      free(indptr);
+      kmem_cache_free(&sector_cache, indptr);
       num_of_sectors -= n;
       if (num_of_sectors == 0) return true;  // done allocation
    }
@@ -482,15 +536,15 @@ static bool inode_allocate(struct inode_disk *inoded, off_t length) {
    // allocate the double indirect pointer if not allocated yet
    if (!_inode_allocate(&inoded->double_indirect_pointer))
       return false;
-   struct inode_indirect_pointer *level1ptr = malloc(sizeof(struct inode_indirect_pointer));
-   struct inode_indirect_pointer *level2ptr = malloc(sizeof(struct inode_indirect_pointer));
+   struct inode_indirect_pointer *level1ptr = kmem_cache_alloc(&sector_cache);
+   struct inode_indirect_pointer *level2ptr = kmem_cache_alloc(&sector_cache);
    block_read (fs_device, inoded->double_indirect_pointer, level1ptr);
 
    // each element of level1ptr (sector pointer) still points to a sector full of pointers (may not yet be allocated)
    for (int i=0; i < INDIRECT_POINTERS_PRE_SECTOR; i++) {
       if (!_inode_allocate(&level1ptr->sector_ptr[i])) {
-         free(level1ptr);
-         free(level2ptr);
+         kmem_cache_free(&sector_cache, level1ptr);
+         kmem_cache_free(&sector_cache, level2ptr);
          return false;
       }
       block_read (fs_device, level1ptr->sector_ptr[i], level2ptr);
@@ -499,8 +553,8 @@ static bool inode_allocate(struct inode_disk *inoded, off_t length) {
       n = num_of_sectors < INDIRECT_POINTERS_PRE_SECTOR ? num_of_sectors : INDIRECT_POINTERS_PRE_SECTOR;
       for (off_t j = 0; j < n; j++) {
          if (!_inode_allocate(&level2ptr->sector_ptr[j])) {
-            free(level1ptr);
-            free(level2ptr);
+            kmem_cache_free(&sector_cache, level1ptr);
+            kmem_cache_free(&sector_cache, level2ptr);
             return false;
          }
       }
@@ -510,8 +564,8 @@ static bool inode_allocate(struct inode_disk *inoded, off_t length) {
       if (num_of_sectors == 0) {
          //  write content in local level1ptr to filesys (may be newly expanded sectors)
          block_write(fs_device, inoded->double_indirect_pointer, &level1ptr);
-         free(level1ptr);
-         free(level2ptr);
+         kmem_cache_free(&sector_cache, level1ptr);
+         kmem_cache_free(&sector_cache, level2ptr);
          return true;
       }
    }
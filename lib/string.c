@@ -1,5 +1,41 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* Blocks shorter than this are moved a byte at a time; for them
+   aligning the destination costs more than it saves. */
+#define WORD_THRESHOLD 16
+
+/* Nonzero if the 32-bit word X contains a zero byte.  See
+   "Determine if a word has a zero byte" in Sean Eron Anderson,
+   "Bit Twiddling Hacks". */
+#define HAS_ZERO_BYTE(X) (((X) - 0x01010101u) & ~(X) & 0x80808080u)
+
+/* A 32-bit word that may alias bytes of any type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Copies SIZE bytes upward from SRC to DST with "rep movs".  If
+   SIZE is large enough, DST is first aligned to a word and the
+   bulk is moved as 32-bit words. */
+static inline void
+copy_up (unsigned char *dst, const unsigned char *src, size_t size)
+{
+  if (size >= WORD_THRESHOLD)
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words;
+
+      size -= head;
+      words = size / 4;
+      size %= 4;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,8 +48,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  copy_up (dst, src, size);
 
   return dst_;
 }
@@ -30,19 +65,34 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (src != NULL || size == 0);
 
   if (dst < src)
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
+    copy_up (dst, src, size);
   else
     {
+      /* Copy downward, so that overlapping bytes are read before
+         they are overwritten: align the end of DST to a word,
+         then move words with the direction flag set. */
       dst += size;
       src += size;
+      if (size >= WORD_THRESHOLD)
+        {
+          size_t words;
+
+          for (; (uintptr_t) dst & 3; size--)
+            *--dst = *--src;
+          words = size / 4;
+          size %= 4;
+          dst -= 4;
+          src -= 4;
+          asm volatile ("std; rep movsl; cld"
+                        : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+          dst += 4;
+          src += 4;
+        }
       while (size-- > 0)
         *--dst = *--src;
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +108,12 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip over equal words; x86 allows unaligned loads.  The
+     first differing word is then compared byte by byte. */
+  for (; size >= 4; a += 4, b += 4, size -= 4)
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -282,8 +338,22 @@ memset (void *dst_, int value, size_t size)
 
   ASSERT (dst != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = value;
+  if (size >= WORD_THRESHOLD)
+    {
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words;
+
+      size -= head;
+      words = size / 4;
+      size %= 4;
+      asm volatile ("rep stosb"
+                    : "+D" (dst), "+c" (head) : "a" (value) : "memory");
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+    }
+  asm volatile ("rep stosb"
+                : "+D" (dst), "+c" (size) : "a" (value) : "memory");
 
   return dst_;
 }
@@ -293,10 +363,19 @@ size_t
 strlen (const char *string)
 {
   const char *p;
+  const word_t *w;
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Step to a word boundary, then look for the null terminator
+     a word at a time.  An aligned word never straddles a page,
+     so this reads no page the string does not reach. */
+  for (p = string; (uintptr_t) p & 3; p++)
+    if (*p == '\0')
+      return p - string;
+  for (w = (const word_t *) p; !HAS_ZERO_BYTE (*w); w++)
+    continue;
+  for (p = (const char *) w; *p != '\0'; p++)
     continue;
   return p - string;
 }
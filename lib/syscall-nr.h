@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_MEMSTAT,                /* Reports memory usage of this process. */
+    SYS_MEMLIMIT,               /* Sets the resident limit of this process. */
+    SYS_MADVISE,                /* Gives a paging hint for a memory range. */
+    SYS_LOCKSTATS               /* Prints lock contention statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,33 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+memstat (struct memstat *st)
+{
+  return syscall1 (SYS_MEMSTAT, st);
+}
+
+bool
+memlimit (unsigned pages)
+{
+  return syscall1 (SYS_MEMLIMIT, pages);
+}
+
+bool
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+void
+lockstats (void)
+{
+  syscall0 (SYS_LOCKSTATS);
+}
@@ -19,6 +19,21 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* Paging hints for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_SEQUENTIAL 1       /* Will be accessed in order; read far ahead. */
+#define MADV_RANDOM 2           /* Will be accessed randomly; no readahead. */
+#define MADV_WILLNEED 3         /* Will be needed soon; load it now. */
+#define MADV_DONTNEED 4         /* Not needed; contents may be discarded. */
+
+/* Memory usage of a process, in pages, filled in by memstat(). */
+struct memstat
+  {
+    unsigned resident;          /* Frames currently mapped. */
+    unsigned working_set;       /* Estimated working-set size. */
+    unsigned resident_limit;    /* Resident limit, 0 if none. */
+  };
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
@@ -45,4 +60,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+bool memstat (struct memstat *);
+bool memlimit (unsigned pages);
+bool madvise (void *addr, unsigned length, int advice);
+void lockstats (void);
+
 #endif /* lib/user/syscall.h */
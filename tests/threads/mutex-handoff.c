@@ -0,0 +1,47 @@
+/* The main thread holds a mutex that a lower-priority thread is
+   waiting for, and releases it.  The mutex must pass to the
+   waiter at once, so that the main thread cannot take it back
+   before the waiter gets to run.  (A lock would let it.) */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func waiter_thread;
+
+void
+test_mutex_handoff (void)
+{
+  struct mutex mutex;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  mutex_init (&mutex);
+  mutex_acquire (&mutex);
+  thread_create ("waiter", PRI_DEFAULT + 1, waiter_thread, &mutex);
+  thread_set_priority (PRI_DEFAULT + 2);
+  mutex_release (&mutex);
+  if (mutex_try_acquire (&mutex))
+    fail ("Main thread took the mutex back from the waiter.");
+  msg ("Mutex was handed to the waiter.");
+  thread_set_priority (PRI_DEFAULT);
+  msg ("Main thread finished.");
+}
+
+static void
+waiter_thread (void *mutex_)
+{
+  struct mutex *mutex = mutex_;
+
+  msg ("Waiter waiting.");
+  mutex_acquire (mutex);
+  msg ("Waiter acquired mutex.");
+  mutex_release (mutex);
+  msg ("Waiter finished.");
+}
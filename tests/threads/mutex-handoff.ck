@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mutex-handoff) begin
+(mutex-handoff) Waiter waiting.
+(mutex-handoff) Mutex was handed to the waiter.
+(mutex-handoff) Waiter acquired mutex.
+(mutex-handoff) Waiter finished.
+(mutex-handoff) Main thread finished.
+(mutex-handoff) end
+EOF
+pass;
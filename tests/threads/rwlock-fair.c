@@ -0,0 +1,57 @@
+/* The main thread holds a fair readers-writer lock for writing,
+   while a reader, a writer and another reader, all at the same
+   priority, queue up for it in that order.  Each must get the
+   lock in arrival order: with writer preference the writer would
+   go first. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread;
+static thread_func reader_thread;
+
+void
+test_rwlock_fair (void)
+{
+  struct rwlock rwlock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock, true);
+  rwlock_write_acquire (&rwlock);
+  thread_create ("reader 1", PRI_DEFAULT + 1, reader_thread, &rwlock);
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread, &rwlock);
+  thread_create ("reader 2", PRI_DEFAULT + 1, reader_thread, &rwlock);
+  msg ("Main thread releasing write lock.");
+  rwlock_write_release (&rwlock);
+  msg ("Main thread finished.");
+}
+
+static void
+writer_thread (void *rwlock_)
+{
+  struct rwlock *rwlock = rwlock_;
+
+  msg ("%s waiting.", thread_name ());
+  rwlock_write_acquire (rwlock);
+  msg ("%s acquired write lock.", thread_name ());
+  rwlock_write_release (rwlock);
+}
+
+static void
+reader_thread (void *rwlock_)
+{
+  struct rwlock *rwlock = rwlock_;
+
+  msg ("%s waiting.", thread_name ());
+  rwlock_read_acquire (rwlock);
+  msg ("%s acquired read lock.", thread_name ());
+  rwlock_read_release (rwlock);
+}
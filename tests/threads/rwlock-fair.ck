@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-fair) begin
+(rwlock-fair) reader 1 waiting.
+(rwlock-fair) writer waiting.
+(rwlock-fair) reader 2 waiting.
+(rwlock-fair) Main thread releasing write lock.
+(rwlock-fair) reader 1 acquired read lock.
+(rwlock-fair) writer acquired write lock.
+(rwlock-fair) reader 2 acquired read lock.
+(rwlock-fair) Main thread finished.
+(rwlock-fair) end
+EOF
+pass;
@@ -0,0 +1,88 @@
+/* Starts several threads that each hold a readers-writer lock
+   for reading while they sleep, and checks that all of them held
+   it at the same time.  Then has the main thread hold the lock
+   for writing while the readers try again, checks that none of
+   them got in, and that all of them get in together once the
+   writer releases it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define READER_CNT 5
+
+struct readers_data
+  {
+    struct rwlock rwlock;       /* Lock under test. */
+    int active;                 /* Readers holding the lock. */
+    int max_active;             /* Most readers seen at once. */
+    struct semaphore done;      /* Upped by each finished reader. */
+  };
+
+static void start_readers (struct readers_data *);
+static void wait_readers (struct readers_data *);
+static thread_func reader_thread;
+
+void
+test_rwlock_readers (void)
+{
+  struct readers_data data;
+
+  rwlock_init (&data.rwlock, false);
+  data.active = data.max_active = 0;
+  sema_init (&data.done, 0);
+
+  start_readers (&data);
+  wait_readers (&data);
+  msg ("%d of %d readers held the lock at once.",
+       data.max_active, READER_CNT);
+
+  data.max_active = 0;
+  rwlock_write_acquire (&data.rwlock);
+  start_readers (&data);
+  timer_sleep (20);
+  msg ("%d readers got in past the writer.", data.max_active);
+  rwlock_write_release (&data.rwlock);
+  wait_readers (&data);
+  msg ("%d of %d readers held the lock at once.",
+       data.max_active, READER_CNT);
+}
+
+static void
+start_readers (struct readers_data *data)
+{
+  int i;
+
+  for (i = 0; i < READER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT, reader_thread, data);
+    }
+}
+
+static void
+wait_readers (struct readers_data *data)
+{
+  int i;
+
+  for (i = 0; i < READER_CNT; i++)
+    sema_down (&data->done);
+}
+
+static void
+reader_thread (void *data_)
+{
+  struct readers_data *data = data_;
+
+  rwlock_read_acquire (&data->rwlock);
+  if (++data->active > data->max_active)
+    data->max_active = data->active;
+  timer_sleep (10);
+  data->active--;
+  rwlock_read_release (&data->rwlock);
+  sema_up (&data->done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-readers) begin
+(rwlock-readers) 5 of 5 readers held the lock at once.
+(rwlock-readers) 0 readers got in past the writer.
+(rwlock-readers) 5 of 5 readers held the lock at once.
+(rwlock-readers) end
+EOF
+pass;
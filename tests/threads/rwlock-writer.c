@@ -0,0 +1,59 @@
+/* The main thread holds a readers-writer lock for reading.  A
+   writer then waits for the lock, followed by a higher-priority
+   reader.  Although only readers hold the lock, the reader must
+   wait behind the writer, which gets the lock as soon as the main
+   thread releases it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread;
+static thread_func reader_thread;
+
+void
+test_rwlock_writer (void)
+{
+  struct rwlock rwlock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock, false);
+  rwlock_read_acquire (&rwlock);
+  msg ("Main thread acquired read lock.");
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread, &rwlock);
+  thread_create ("reader", PRI_DEFAULT + 2, reader_thread, &rwlock);
+  msg ("Main thread releasing read lock.");
+  rwlock_read_release (&rwlock);
+  msg ("Main thread finished.");
+}
+
+static void
+writer_thread (void *rwlock_)
+{
+  struct rwlock *rwlock = rwlock_;
+
+  msg ("Writer waiting.");
+  rwlock_write_acquire (rwlock);
+  msg ("Writer acquired write lock.");
+  rwlock_write_release (rwlock);
+  msg ("Writer finished.");
+}
+
+static void
+reader_thread (void *rwlock_)
+{
+  struct rwlock *rwlock = rwlock_;
+
+  msg ("Reader waiting.");
+  rwlock_read_acquire (rwlock);
+  msg ("Reader acquired read lock.");
+  rwlock_read_release (rwlock);
+  msg ("Reader finished.");
+}
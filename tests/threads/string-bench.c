@@ -0,0 +1,174 @@
+/* Times memcpy, memmove, memset, memcmp and strlen from
+   lib/string.c on 64 kB blocks against plain byte-at-a-time
+   loops, after checking that they agree with them.  Each optimized routine
+   should be no slower than its loop. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+#define BLOCK_PAGES 16
+#define BLOCK_SIZE (BLOCK_PAGES * PGSIZE)
+#define ITERATIONS 64
+
+/* The loops go through volatile pointers, so that the compiler
+   cannot turn them back into calls to the routines under test. */
+
+static void
+byte_memcpy (void *dst_, const void *src_, size_t size)
+{
+  volatile unsigned char *dst = dst_;
+  const volatile unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+byte_memmove (void *dst_, const void *src_, size_t size)
+{
+  volatile unsigned char *dst = (unsigned char *) dst_ + size;
+  const volatile unsigned char *src = (const unsigned char *) src_ + size;
+
+  while (size-- > 0)
+    *--dst = *--src;
+}
+
+static void
+byte_memset (void *dst_, int value, size_t size)
+{
+  volatile unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+static int
+byte_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const volatile unsigned char *a = a_;
+  const volatile unsigned char *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static size_t
+byte_strlen (const char *string)
+{
+  const volatile char *p = string;
+
+  while (*p != '\0')
+    p++;
+  return p - string;
+}
+
+static uint8_t *src, *dst;
+static volatile int sink;
+
+/* Runs each of FAST and SLOW on the blocks ITERATIONS times and
+   reports how many timer ticks each took. */
+static void
+bench (const char *name, void (*fast) (void), void (*slow) (void))
+{
+  int64_t start;
+  int64_t fast_ticks, slow_ticks;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < ITERATIONS; i++)
+    fast ();
+  fast_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < ITERATIONS; i++)
+    slow ();
+  slow_ticks = timer_elapsed (start);
+
+  msg ("%s: %"PRId64" ticks, byte loop %"PRId64" ticks",
+       name, fast_ticks, slow_ticks);
+}
+
+static void fast_memcpy (void) { memcpy (dst + 1, src, BLOCK_SIZE - 1); }
+static void slow_memcpy (void) { byte_memcpy (dst + 1, src, BLOCK_SIZE - 1); }
+static void fast_memmove (void) { memmove (src + 3, src, BLOCK_SIZE - 3); }
+static void slow_memmove (void) { byte_memmove (src + 3, src, BLOCK_SIZE - 3); }
+static void fast_memset (void) { memset (dst, 0, BLOCK_SIZE); }
+static void slow_memset (void) { byte_memset (dst, 0, BLOCK_SIZE); }
+static void fast_memcmp (void) { sink = memcmp (src, dst, BLOCK_SIZE); }
+static void slow_memcmp (void) { sink = byte_memcmp (src, dst, BLOCK_SIZE); }
+static void fast_strlen (void) { sink = strlen ((char *) dst + 1); }
+static void slow_strlen (void) { sink = byte_strlen ((char *) dst + 1); }
+
+/* Checks strlen against a byte loop for every start offset within
+   a word and every terminator position up to a few words on.  The
+   other bytes have their high bits set or are 0x01, which catch
+   a zero-byte test that mistakes them for a terminator. */
+static void
+check_strlen (void)
+{
+  static const uint8_t fill[] = {0x80, 0x01, 0xff, 0x7f, 0x81, 0x01, 0x80};
+  size_t start, len, i;
+
+  for (start = 0; start < 8; start++)
+    for (len = 0; len < 40; len++)
+      {
+        char *s = (char *) dst + start;
+        for (i = 0; i < len + 8; i++)
+          s[i] = fill[(start + i) % sizeof fill];
+        s[len] = '\0';
+        if (strlen (s) != len || byte_strlen (s) != len)
+          fail ("strlen at offset %zu returned %zu, expected %zu",
+                start, strlen (s), len);
+      }
+}
+
+void
+test_string_bench (void)
+{
+  size_t i;
+
+  src = palloc_get_multiple (PAL_ASSERT, BLOCK_PAGES);
+  dst = palloc_get_multiple (PAL_ASSERT, BLOCK_PAGES);
+  for (i = 0; i < BLOCK_SIZE; i++)
+    src[i] = i * 7 + 3;
+
+  /* Results must match the loops, at odd offsets too. */
+  memcpy (dst + 1, src + 2, 1000);
+  if (byte_memcmp (dst + 1, src + 2, 1000) != 0)
+    fail ("memcpy copied wrong bytes");
+  memmove (dst + 5, dst + 1, 1000);
+  if (byte_memcmp (dst + 5, src + 2, 1000) != 0)
+    fail ("memmove copied wrong bytes");
+  memset (dst + 3, 0x5a, 777);
+  for (i = 3; i < 780; i++)
+    if (dst[i] != 0x5a)
+      fail ("memset stored wrong bytes");
+  if (memcmp (dst + 3, src, 777) != byte_memcmp (dst + 3, src, 777))
+    fail ("memcmp disagrees with a byte loop");
+  check_strlen ();
+
+  memcpy (dst, src, BLOCK_SIZE);
+  bench ("memcpy", fast_memcpy, slow_memcpy);
+  bench ("memmove", fast_memmove, slow_memmove);
+  bench ("memset", fast_memset, slow_memset);
+  memcpy (dst, src, BLOCK_SIZE);
+  bench ("memcmp", fast_memcmp, slow_memcmp);
+
+  /* A string filling the block from an odd offset. */
+  memset (dst, 0x81, BLOCK_SIZE - 1);
+  dst[BLOCK_SIZE - 1] = '\0';
+  if (strlen ((char *) dst + 1) != BLOCK_SIZE - 2)
+    fail ("strlen miscounted a long string");
+  bench ("strlen", fast_strlen, slow_strlen);
+
+  palloc_free_multiple (src, BLOCK_PAGES);
+  palloc_free_multiple (dst, BLOCK_PAGES);
+  pass ();
+}
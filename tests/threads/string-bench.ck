@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my ($timings) = 0;
+foreach (@output) {
+    my ($name, $fast, $slow)
+      = /\(string-bench\) (\w+): (\d+) ticks, byte loop (\d+) ticks/
+      or next;
+    # Allow a tick either way: each timing can be off by one.
+    fail "$name took $fast ticks, slower than a byte loop ($slow ticks).\n"
+      if $fast > $slow + 1;
+    $timings++;
+}
+fail "Expected 5 timings, found $timings.\n" if $timings != 5;
+fail "Test did not pass.\n" if !grep (/^\(string-bench\) PASS$/, @output);
+pass;
@@ -39,6 +39,12 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"string-bench", test_string_bench},
+    {"rwlock-readers", test_rwlock_readers},
+    {"rwlock-writer", test_rwlock_writer},
+    {"rwlock-fair", test_rwlock_fair},
+    {"mutex-handoff", test_mutex_handoff},
+    {"timer-wheel", test_timer_wheel},
   };
 
 static const char *test_name;
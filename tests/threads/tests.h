@@ -33,6 +33,12 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_string_bench;
+extern test_func test_rwlock_readers;
+extern test_func test_rwlock_writer;
+extern test_func test_rwlock_fair;
+extern test_func test_mutex_handoff;
+extern test_func test_timer_wheel;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
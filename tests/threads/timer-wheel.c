@@ -0,0 +1,101 @@
+/* Arms callback timers due 1, 63, 64, 65, 4095, 4096 and 4160
+   ticks out, which land in the first three levels of the timing
+   wheel and must cascade down level by level, plus one due in
+   100 ticks that is canceled while pending.  Each callback must
+   run on the very tick its timer is due, in order of expiry, and
+   the canceled one must never run.  Canceling a timer that has
+   already run must report that it was not pending. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "devices/timer.h"
+
+/* Ticks until each timer is due, in order of expiry. */
+static const int64_t deltas[] = {1, 63, 64, 65, 4095, 4096, 4160};
+#define TIMER_CNT (sizeof deltas / sizeof *deltas)
+
+/* Timer that is canceled before it expires. */
+#define CANCEL_DELTA 100
+
+static struct timer timers[TIMER_CNT];
+static struct timer cancel_timer;
+
+/* Timer indexes in the order the callbacks ran, and the tick
+   each one ran on. */
+static size_t fired[TIMER_CNT + 1];
+static int64_t fired_ticks[TIMER_CNT + 1];
+static size_t fired_cnt;
+
+/* Upped by each callback. */
+static struct semaphore fired_sema;
+
+static timer_func record_timer;
+
+void
+test_timer_wheel (void)
+{
+  enum intr_level old_level;
+  int64_t start;
+  size_t i;
+
+  sema_init (&fired_sema, 0);
+
+  /* Arm every timer within one tick, so that they share START. */
+  old_level = intr_disable ();
+  start = timer_ticks ();
+  for (i = 0; i < TIMER_CNT; i++)
+    {
+      timer_setup (&timers[i], record_timer, (void *) i);
+      timer_add (&timers[i], deltas[i]);
+    }
+  timer_setup (&cancel_timer, record_timer, (void *) TIMER_CNT);
+  timer_add (&cancel_timer, CANCEL_DELTA);
+  intr_set_level (old_level);
+
+  if (!timer_cancel (&cancel_timer))
+    fail ("canceling a pending timer reported it was not pending");
+  if (timer_pending (&cancel_timer))
+    fail ("canceled timer is still pending");
+
+  for (i = 0; i < TIMER_CNT; i++)
+    sema_down (&fired_sema);
+
+  /* Every timer has now run once, so none can still be canceled. */
+  for (i = 0; i < TIMER_CNT; i++)
+    if (timer_cancel (&timers[i]))
+      fail ("timer %zu was still pending after it ran", i);
+
+  if (fired_cnt != TIMER_CNT)
+    fail ("%zu callbacks ran, expected %zu", fired_cnt, TIMER_CNT);
+  for (i = 0; i < TIMER_CNT; i++)
+    {
+      size_t idx = fired[i];
+
+      if (idx != i)
+        fail ("callback %zu was timer %zu, expected timer %zu",
+              i, idx, i);
+      if (fired_ticks[i] != start + deltas[idx])
+        fail ("timer %zu due after %"PRId64" ticks ran after %"PRId64,
+              idx, deltas[idx], fired_ticks[i] - start);
+      msg ("timer due after %"PRId64" ticks ran on time.", deltas[idx]);
+    }
+}
+
+/* Records that the timer with index AUX ran, and on what tick. */
+static void
+record_timer (void *aux)
+{
+  enum intr_level old_level = intr_disable ();
+  if (fired_cnt < TIMER_CNT + 1)
+    {
+      fired[fired_cnt] = (size_t) aux;
+      fired_ticks[fired_cnt] = timer_ticks ();
+      fired_cnt++;
+    }
+  intr_set_level (old_level);
+  sema_up (&fired_sema);
+}
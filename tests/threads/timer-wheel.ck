@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(timer-wheel) begin
+(timer-wheel) timer due after 1 ticks ran on time.
+(timer-wheel) timer due after 63 ticks ran on time.
+(timer-wheel) timer due after 64 ticks ran on time.
+(timer-wheel) timer due after 65 ticks ran on time.
+(timer-wheel) timer due after 4095 ticks ran on time.
+(timer-wheel) timer due after 4096 ticks ran on time.
+(timer-wheel) timer due after 4160 ticks ran on time.
+(timer-wheel) end
+EOF
+pass;
@@ -0,0 +1,23 @@
+/* Forks a child, which sees fork() return 0 and exits with a
+   known status.  The parent sees the child's pid and collects
+   that status with wait(), which fails on a second try. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      msg ("child run");
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork() returned %d", pid);
+
+  msg ("wait(fork()) = %d", wait (pid));
+  msg ("wait(fork()) again = %d", wait (pid));
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-basic) begin
+(fork-basic) child run
+fork-basic: exit(81)
+(fork-basic) wait(fork()) = 81
+(fork-basic) wait(fork()) again = -1
+(fork-basic) end
+fork-basic: exit(0)
+EOF
+pass;
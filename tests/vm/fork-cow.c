@@ -0,0 +1,64 @@
+/* After fork, the parent and the child each write to the same
+   pages: a data buffer written before the fork, a buffer still
+   all zeros, and a local variable.  Each must see its own writes
+   only.  The parent writes while the pages are still shared. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 4096)
+
+static char buf[SIZE];
+static char zeros[SIZE];
+
+/* Fails unless every byte of the SIZE bytes at P is C. */
+static void
+check_bytes (const char *who, const char *name, const char *p, char c)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (p[i] != c)
+      fail ("%s: %s[%zu] is 0x%02x, not 0x%02x",
+            who, name, i, p[i] & 0xff, c & 0xff);
+}
+
+void
+test_main (void)
+{
+  int local = 1;
+  pid_t pid;
+
+  memset (buf, 'a', SIZE);
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_bytes ("child", "buf", buf, 'a');
+      check_bytes ("child", "zeros", zeros, 0);
+      if (local != 1)
+        fail ("child: local is %d, not 1", local);
+
+      memset (buf, 'c', SIZE);
+      memset (zeros, 'z', SIZE);
+      local = 3;
+      check_bytes ("child", "buf", buf, 'c');
+      check_bytes ("child", "zeros", zeros, 'z');
+      if (local != 3)
+        fail ("child: local is %d, not 3", local);
+      exit (42);
+    }
+  if (pid < 0)
+    fail ("fork() returned %d", pid);
+
+  memset (buf, 'p', SIZE);
+  local = 2;
+  check_bytes ("parent", "buf", buf, 'p');
+
+  msg ("wait(fork()) = %d", wait (pid));
+  check_bytes ("parent", "buf", buf, 'p');
+  check_bytes ("parent", "zeros", zeros, 0);
+  if (local != 2)
+    fail ("parent: local is %d, not 2", local);
+}
@@ -0,0 +1,53 @@
+/* Forks a process with a 2 MB buffer, more than fits in memory,
+   so pages shared copy-on-write by parent and child are evicted
+   while both map them, and each reads them back in turn.  The
+   child then overwrites its copy, which must leave the parent's
+   intact.  Each page holds a different byte, so a page read back
+   from the wrong slot is caught. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless each page of BUF holds its page number plus
+   OFFSET. */
+static void
+check_buf (const char *who, int offset)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i / 4096 + offset))
+      fail ("%s: byte %zu is 0x%02x, not 0x%02x", who, i,
+            buf[i] & 0xff, (i / 4096 + offset) & 0xff);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i / 4096;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_buf ("child", 0);
+      for (i = 0; i < SIZE; i++)
+        buf[i] = i / 4096 + 1;
+      check_buf ("child", 1);
+      exit (42);
+    }
+  if (pid < 0)
+    fail ("fork() returned %d", pid);
+
+  check_buf ("parent", 0);
+  msg ("wait(fork()) = %d", wait (pid));
+  check_buf ("parent", 0);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-swap) begin
+fork-swap: exit(42)
+(fork-swap) wait(fork()) = 42
+(fork-swap) end
+fork-swap: exit(0)
+EOF
+pass;
@@ -0,0 +1,85 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point numbers, for the MLFQS scheduler's
+   load_avg and recent_cpu.  The kernel does not use floating
+   point, so real values are stored in an int scaled by FP_F:
+   17 bits before the binary point, 14 after, and a sign bit. */
+typedef int fixed_point;
+
+#define FP_Q 14                 /* Bits after the binary point. */
+#define FP_F (1 << FP_Q)        /* Fixed-point 1. */
+
+/* Returns integer N as a fixed-point number. */
+static inline fixed_point
+fp_from_int (int n)
+{
+  return n * FP_F;
+}
+
+/* Returns X truncated toward zero. */
+static inline int
+fp_to_int (fixed_point x)
+{
+  return x / FP_F;
+}
+
+/* Returns X rounded to the nearest integer. */
+static inline int
+fp_round (fixed_point x)
+{
+  return x >= 0 ? (x + FP_F / 2) / FP_F : (x - FP_F / 2) / FP_F;
+}
+
+/* Returns X + Y. */
+static inline fixed_point
+fp_add (fixed_point x, fixed_point y)
+{
+  return x + y;
+}
+
+/* Returns X - Y. */
+static inline fixed_point
+fp_sub (fixed_point x, fixed_point y)
+{
+  return x - y;
+}
+
+/* Returns X + N, for integer N. */
+static inline fixed_point
+fp_add_int (fixed_point x, int n)
+{
+  return x + n * FP_F;
+}
+
+/* Returns X * Y. */
+static inline fixed_point
+fp_mul (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * y / FP_F;
+}
+
+/* Returns X * N, for integer N. */
+static inline fixed_point
+fp_mul_int (fixed_point x, int n)
+{
+  return x * n;
+}
+
+/* Returns X / Y. */
+static inline fixed_point
+fp_div (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * FP_F / y;
+}
+
+/* Returns X / N, for integer N. */
+static inline fixed_point
+fp_div_int (fixed_point x, int n)
+{
+  return x / n;
+}
+
+#endif /* threads/fixed-point.h */
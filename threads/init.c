@@ -20,7 +20,10 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -33,7 +36,9 @@
 #endif
 #ifdef VM
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
@@ -101,6 +106,7 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  kmem_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -121,6 +127,7 @@ main (void)
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  timer_start ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -134,7 +141,9 @@ main (void)
 #ifdef VM
   /* Initialize Virtual memory system. (Project 3) */
   frame_table_init();
+  spte_cache_init();
   swap_init();       // must be after filesys_init
+  zswap_init();
 #endif
 
   printf ("Boot complete.\n");
@@ -181,6 +190,17 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      /* Map each whole 4 MB of RAM that holds no kernel text with
+         a single large page.  This saves a page table per 4 MB
+         and, more importantly, lets one TLB entry cover it. */
+      if (pte_idx == 0 && page + LGPGCNT <= init_ram_pages
+          && (vaddr + LGPGSIZE <= &_start || &_end_kernel_text <= vaddr))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true, false);
+          page += LGPGCNT - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -194,7 +214,12 @@ paging_init (void)
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
-     of the Page Directory". */
+     of the Page Directory".
+     Large pages need page size extensions, so turn on CR4.PSE
+     first.  See [IA32-v3a] 3.7.3 "Mixing 4-KByte and 4-MByte
+     Pages". */
+  asm volatile ("movl %%cr4, %%eax; orl %0, %%eax; movl %%eax, %%cr4"
+                : : "i" (CR4_PSE) : "eax");
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
@@ -266,9 +291,30 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-nohz"))
+        timer_nohz = true;
+      else if (!strcmp (name, "-lockprof"))
+        lock_profile = true;
+      else if (!strcmp (name, "-profstart"))
+        {
+          profile_enabled = true;
+          profile_start_tick = value != NULL ? atoi (value) : 0;
+        }
+      else if (!strcmp (name, "-profstop"))
+        profile_stop_tick = atoi (value);
+      else if (!strcmp (name, "-profbt"))
+        profile_depth = atoi (value) + 1;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-lp"))
+        large_user_pages = true;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-fa"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-rl"))
+        frame_resident_limit = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -389,8 +435,18 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -nohz              Stop the timer tick while idle.\n"
+          "  -lockprof          Report lock contention at shutdown.\n"
+          "  -profstart[=TICK]  Sample the running code from timer tick TICK.\n"
+          "  -profstop=TICK     Stop sampling at timer tick TICK.\n"
+          "  -profbt=DEPTH      Record DEPTH callers in each kernel sample.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -lp                Map aligned 4 MB runs of BSS with 4 MB pages.\n"
+#endif
+#ifdef VM
+          "  -fa=COUNT          Map up to COUNT executable pages per page fault.\n"
+          "  -rl=COUNT          Limit each process to COUNT resident pages.\n"
 #endif
           );
   shutdown_power_off ();
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -28,6 +29,18 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   Each thread also keeps a "magazine" of free blocks for every
+   descriptor (see struct malloc_magazine).  malloc() and free()
+   work on the current thread's magazine alone, without locking,
+   and take the descriptor's lock only to refill an empty
+   magazine or drain a full one, MALLOC_MAG_BATCH blocks at a
+   time.  Blocks in a magazine count as in use for their arena.
+
+   An arena whose blocks are all free is kept, up to
+   EMPTY_ARENA_CNT per descriptor, so that a workload hovering
+   around an arena boundary does not allocate and free a page on
+   every other call.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
@@ -40,9 +53,14 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Arenas with no blocks in use. */
     struct lock lock;           /* Lock. */
   };
 
+/* Number of empty arenas a descriptor keeps instead of returning
+   them to the page allocator. */
+#define EMPTY_ARENA_CNT 1
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -61,11 +79,14 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_DESC_CNT];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void magazine_refill (struct desc *, struct malloc_magazine *);
+static void magazine_drain (struct desc *, struct malloc_magazine *,
+                            size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -80,8 +101,22 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->empty_cnt = 0;
       lock_init (&d->lock);
     }
+  ASSERT (desc_cnt == MALLOC_DESC_CNT);
+}
+
+/* Returns every block in the current thread's magazines to its
+   descriptor.  Called when the thread exits. */
+void
+malloc_drain_magazines (void)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    magazine_drain (&descs[i], &t->malloc_mags[i], t->malloc_mags[i].cnt);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -90,8 +125,8 @@ void *
 malloc (size_t size)
 {
   struct desc *d;
-  struct block *b;
   struct arena *a;
+  struct malloc_magazine *m;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -119,38 +154,14 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  m = &thread_current ()->malloc_mags[d - descs];
+  if (m->cnt == 0)
     {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL)
-        {
-          lock_release (&d->lock);
-          return NULL;
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++)
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      magazine_refill (d, m);
+      if (m->cnt == 0)
+        return NULL;
     }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  return m->blocks[--m->cnt];
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -226,33 +237,19 @@ free (void *p)
 
       if (d != NULL)
         {
-          /* It's a normal block.  We handle it here. */
+          /* It's a normal block.  Put it in our magazine, making
+             room first if the magazine is full. */
+          struct malloc_magazine *m
+            = &thread_current ()->malloc_mags[d - descs];
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
 
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena)
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++)
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+          if (m->cnt == MALLOC_MAG_SIZE)
+            magazine_drain (d, m, MALLOC_MAG_BATCH);
+          m->blocks[m->cnt++] = b;
         }
       else
         {
@@ -292,3 +289,96 @@ arena_to_block (struct arena *a, size_t idx)
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+/* Moves up to MALLOC_MAG_BATCH free blocks from descriptor D
+   into the empty magazine M, creating an arena if D has no free
+   blocks.  Leaves M empty if no memory is available. */
+static void
+magazine_refill (struct desc *d, struct malloc_magazine *m)
+{
+  ASSERT (m->cnt == 0);
+
+  lock_acquire (&d->lock);
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      struct arena *a;
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL)
+        {
+          lock_release (&d->lock);
+          return;
+        }
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      d->empty_cnt++;
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Get blocks from the free list. */
+  while (m->cnt < MALLOC_MAG_BATCH && !list_empty (&d->free_list))
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      struct arena *a = block_to_arena (b);
+
+      if (a->free_cnt-- == d->blocks_per_arena)
+        d->empty_cnt--;
+      m->blocks[m->cnt++] = b;
+    }
+
+  lock_release (&d->lock);
+}
+
+/* Returns CNT blocks from magazine M to descriptor D.  An arena
+   left with no blocks in use is freed, unless D has fewer than
+   EMPTY_ARENA_CNT empty arenas. */
+static void
+magazine_drain (struct desc *d, struct malloc_magazine *m, size_t cnt)
+{
+  ASSERT (cnt <= m->cnt);
+
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&d->lock);
+  while (cnt-- > 0)
+    {
+      struct block *b = m->blocks[--m->cnt];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, keep it or free it. */
+      if (++a->free_cnt >= d->blocks_per_arena)
+        {
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          if (d->empty_cnt < EMPTY_ARENA_CNT)
+            d->empty_cnt++;
+          else
+            {
+              size_t i;
+
+              for (i = 0; i < d->blocks_per_arena; i++)
+                {
+                  struct block *b = arena_to_block (a, i);
+                  list_remove (&b->free_elem);
+                }
+              palloc_free_page (a);
+            }
+        }
+    }
+  lock_release (&d->lock);
+}
@@ -4,7 +4,24 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of malloc() size classes: 16, 32, ..., 1024 bytes. */
+#define MALLOC_DESC_CNT 7
+
+/* Free blocks of one size class cached by a thread. */
+#define MALLOC_MAG_SIZE 8
+
+/* Blocks moved between a magazine and its size class at once. */
+#define MALLOC_MAG_BATCH (MALLOC_MAG_SIZE / 2)
+
+/* A thread's cache of free blocks of one size class. */
+struct malloc_magazine
+  {
+    void *blocks[MALLOC_MAG_SIZE];
+    size_t cnt;
+  };
+
 void malloc_init (void);
+void malloc_drain_magazines (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
@@ -2,13 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/pte.h"
+#include "threads/interrupt.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,7 +25,24 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  Free memory is
+   kept as blocks of 2**ORDER pages, one free list per order, and
+   every block is aligned to its own size in physical memory.  An
+   allocation takes the smallest block that fits, splitting larger
+   blocks as needed, and hands the unused tail of the block back.
+   A freed block is merged with its buddy (the other half of the
+   block it was split from) for as long as the buddy is free, so
+   both allocation and free take O(log n) time. */
+
+/* Number of block orders.  The largest block is 2**(ORDER_CNT-1)
+   pages, which is more than any pool holds. */
+#define ORDER_CNT 20
+
+/* Value in a pool's orders[] for a page that does not start a
+   free block. */
+#define NOT_FREE 0xff
 
 /*
    A memory pool.
@@ -31,17 +50,27 @@
 */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks, by order. */
+    uint8_t *orders;                    /* Order of each free block,
+                                           indexed by its first page. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
   };
 
+/* The pools are protected by disabling interrupts rather than by
+   a lock, because thread_schedule_tail() frees the page of a dying
+   thread with interrupts off, where it must not block.  Buddy
+   operations are short enough that this costs little. */
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t block_order (size_t page_cnt);
+static void *take_block (struct pool *, size_t order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -79,20 +108,26 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  void *pages = NULL;
+  size_t order;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);  // the index of the page starting from which can be allocated
-  lock_release (&pool->lock);
+  order = block_order (page_cnt);
+  old_level = intr_disable ();
+  if (order < ORDER_CNT)
+    pages = take_block (pool, order);
+  if (pages != NULL)
+    {
+      size_t page_idx = pg_no (pages) - pg_no (pool->base);
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;  // need + base here cuz pool may be user or kernel
-  else
-    pages = NULL;
+      /* Give back the part of the block we don't need. */
+      free_range (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+    }
+  intr_set_level (old_level);
 
   if (pages != NULL)
     {
@@ -108,6 +143,21 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Obtains a 4 MB run of free pages whose physical address is
+   4 MB aligned, so that it can be mapped by a single large-page
+   PDE (see pde_create_large()).  Behaves like
+   palloc_get_multiple() otherwise.  Returns a null pointer if
+   no aligned run is free, which is common: callers are expected
+   to fall back to ordinary pages. */
+void *
+palloc_get_large (enum palloc_flags flags)
+{
+  /* Buddy blocks are aligned to their size, so any block of
+     LGPGCNT pages is suitably aligned. */
+  ASSERT (LGPGCNT == (size_t) 1 << block_order (LGPGCNT));
+  return palloc_get_multiple (flags, LGPGCNT);
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -127,6 +177,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -145,7 +196,11 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+  old_level = intr_disable ();
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -160,10 +215,12 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map at its base, followed by its
+     orders array.  Calculate the space needed for them and
+     subtract it from the pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  size_t order;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -171,9 +228,15 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
   p->base = base + bm_pages * PGSIZE;  // bitmap at the beginning of the pool, the rest is space available
+
+  /* Carve the pool into the largest aligned blocks that fit. */
+  free_range (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -187,3 +250,104 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static size_t
+block_order (size_t page_cnt)
+{
+  size_t order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Returns the free list element stored in page PAGE_IDX of POOL,
+   which must start a free block. */
+static struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Puts the free block of 2**ORDER pages starting at PAGE_IDX on
+   POOL's free list for ORDER. */
+static void
+insert_block (struct pool *pool, size_t page_idx, size_t order)
+{
+  pool->orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Removes a free block of 2**ORDER pages from POOL, splitting a
+   larger block if there is none of that order, and returns it.
+   Returns a null pointer if POOL has no block large enough.
+   Interrupts must be off. */
+static void *
+take_block (struct pool *pool, size_t order)
+{
+  size_t cur;
+
+  for (cur = order; cur < ORDER_CNT; cur++)
+    if (!list_empty (&pool->free_lists[cur]))
+      {
+        uint8_t *block = (uint8_t *) list_pop_front (&pool->free_lists[cur]);
+        size_t page_idx = (block - pool->base) / PGSIZE;
+
+        pool->orders[page_idx] = NOT_FREE;
+        while (cur > order)
+          {
+            cur--;
+            insert_block (pool, page_idx + ((size_t) 1 << cur), cur);
+          }
+        return block;
+      }
+  return NULL;
+}
+
+/* Frees the block of 2**ORDER pages starting at PAGE_IDX in POOL,
+   merging it with its buddy for as long as the buddy is free.
+   Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, size_t order)
+{
+  size_t base_no = pg_no (pool->base);
+  size_t page_cnt = bitmap_size (pool->used_map);
+
+  /* Buddies are found from physical page numbers, not pool
+     indexes, so that blocks stay aligned to their size. */
+  for (; order + 1 < ORDER_CNT; order++)
+    {
+      size_t buddy_idx = ((base_no + page_idx) ^ ((size_t) 1 << order)) - base_no;
+
+      if (buddy_idx >= page_cnt || pool->orders[buddy_idx] != order)
+        break;
+      list_remove (block_elem (pool, buddy_idx));
+      pool->orders[buddy_idx] = NOT_FREE;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+    }
+  insert_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   need not form a single block, by freeing the largest aligned
+   blocks that make up the range.  Interrupts must be off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t base_no = pg_no (pool->base);
+
+  while (page_cnt > 0)
+    {
+      size_t order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && ((size_t) 2 << order) <= page_cnt
+             && ((base_no + page_idx) & (((size_t) 2 << order) - 1)) == 0)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
@@ -0,0 +1,162 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   With -profstart, each timer interrupt between ticks
+   profile_start_tick and profile_stop_tick records where it
+   interrupted: the instruction address and, in the kernel, up to
+   profile_depth - 1 return addresses found by following the
+   frame pointers.  Identical stacks share one slot of a fixed
+   hash table, since the interrupt handler cannot allocate.
+   profile_print_stats() prints each stack as a "Call stack:" line
+   that the "backtrace" utility symbolizes. */
+bool profile_enabled;
+int64_t profile_start_tick;
+int64_t profile_stop_tick = INT64_MAX;
+int profile_depth = 1;
+
+/* A distinct stack and the number of samples that found it. */
+struct profile_slot
+  {
+    unsigned count;                     /* Samples; 0 if slot unused. */
+    void *pcs[PROFILE_DEPTH];           /* Addresses, innermost first,
+                                           null-padded. */
+  };
+
+/* Hash table of stacks, with linear probing. */
+#define PROFILE_SLOT_CNT 1024
+static struct profile_slot slots[PROFILE_SLOT_CNT];
+
+/* Statistics. */
+static unsigned sample_cnt;             /* Samples taken. */
+static unsigned user_cnt;               /* Samples in user programs. */
+static unsigned dropped_cnt;            /* Samples with no free slot. */
+
+static void backtrace (const struct intr_frame *, void *pcs[PROFILE_DEPTH]);
+static int slot_compare (const void *, const void *);
+
+/* Records a sample of the code interrupted by timer interrupt
+   frame F.  Called at each timer tick, in the timer interrupt
+   handler. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  void *pcs[PROFILE_DEPTH];
+  unsigned i, start;
+  int64_t now;
+
+  ASSERT (intr_context ());
+
+  if (!profile_enabled)
+    return;
+  now = timer_ticks ();
+  if (now < profile_start_tick || now >= profile_stop_tick)
+    return;
+
+  memset (pcs, 0, sizeof pcs);
+  backtrace (f, pcs);
+  sample_cnt++;
+  if (is_user_vaddr (pcs[0]))
+    user_cnt++;
+
+  start = hash_bytes (pcs, sizeof pcs) % PROFILE_SLOT_CNT;
+  for (i = 0; i < PROFILE_SLOT_CNT; i++)
+    {
+      struct profile_slot *s = &slots[(start + i) % PROFILE_SLOT_CNT];
+      if (s->count == 0)
+        memcpy (s->pcs, pcs, sizeof pcs);
+      if (!memcmp (s->pcs, pcs, sizeof pcs))
+        {
+          s->count++;
+          return;
+        }
+    }
+  dropped_cnt++;
+}
+
+/* Stores in PCS the address of the instruction interrupted by F
+   followed, if it was kernel code, by the return addresses of up
+   to profile_depth - 1 of its callers.
+
+   User stacks are not followed, because reading them could page
+   fault.  Kernel frames are followed only while they stay on the
+   interrupted thread's stack page, which also holds F, and move
+   toward its top. */
+static void
+backtrace (const struct intr_frame *f, void *pcs[PROFILE_DEPTH])
+{
+  void **frame = (void **) f->ebp;
+  uintptr_t page = (uintptr_t) pg_round_down (f);
+  int depth = profile_depth < PROFILE_DEPTH ? profile_depth : PROFILE_DEPTH;
+  int n = 0;
+
+  pcs[n++] = (void *) f->eip;
+  if (is_user_vaddr (pcs[0]))
+    return;
+  while (n < depth
+         && (uintptr_t) pg_round_down (frame) == page
+         && (uintptr_t) frame > (uintptr_t) f
+         && (uintptr_t) (frame + 2) <= page + PGSIZE
+         && frame[1] != NULL)
+    {
+      pcs[n++] = frame[1];
+      if ((void **) frame[0] <= frame)
+        break;
+      frame = frame[0];
+    }
+}
+
+/* Orders profile_slots by descending sample count. */
+static int
+slot_compare (const void *a_, const void *b_)
+{
+  const struct profile_slot *a = a_;
+  const struct profile_slot *b = b_;
+
+  return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/* Stops sampling and prints the samples taken, most frequent
+   stack first, if -profstart was given. */
+void
+profile_print_stats (void)
+{
+  size_t used, i;
+  enum intr_level old_level;
+
+  if (!profile_enabled)
+    return;
+
+  /* Stop sampling, then sort the used slots to the front. */
+  old_level = intr_disable ();
+  profile_enabled = false;
+  intr_set_level (old_level);
+  qsort (slots, PROFILE_SLOT_CNT, sizeof *slots, slot_compare);
+  for (used = 0; used < PROFILE_SLOT_CNT && slots[used].count > 0; used++)
+    continue;
+
+  printf ("Profile: %u samples, %u in user programs, %u dropped, "
+          "%zu stacks\n", sample_cnt, user_cnt, dropped_cnt, used);
+  for (i = 0; i < used; i++)
+    {
+      const struct profile_slot *s = &slots[i];
+      unsigned permille = (unsigned) ((uint64_t) s->count * 1000
+                                      / sample_cnt);
+      int j;
+
+      printf ("%6u %3u.%u%% %s Call stack:", s->count,
+              permille / 10, permille % 10,
+              is_user_vaddr (s->pcs[0]) ? "user  " : "kernel");
+      for (j = 0; j < PROFILE_DEPTH && s->pcs[j] != NULL; j++)
+        printf (" %p", s->pcs[j]);
+      printf (".\n");
+    }
+}
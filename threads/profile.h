@@ -0,0 +1,22 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Most return addresses recorded per sample, including the
+   interrupted instruction. */
+#define PROFILE_DEPTH 8
+
+/* Sampling profiler settings, set by kernel command-line
+   options. */
+extern bool profile_enabled;            /* -profstart given? */
+extern int64_t profile_start_tick;      /* First timer tick sampled. */
+extern int64_t profile_stop_tick;       /* First timer tick not sampled. */
+extern int profile_depth;               /* Addresses per sample. */
+
+void profile_sample (const struct intr_frame *);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
@@ -66,6 +66,16 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+
+/* A PDE with PTE_PS set maps a 4 MB "large" page directly,
+   without a page table, when page size extensions are enabled
+   (CR4.PSE).  Its frame must be 4 MB aligned. */
+#define LGPGSIZE PTSPAN                  /* Bytes in a large page. */
+#define LGPGMASK (LGPGSIZE - 1)          /* Large page offset bits (0:21). */
+#define LGPGCNT (LGPGSIZE / PGSIZE)      /* Pages in a large page. */
+#define PDE_LGADDR 0xffc00000            /* Address bits of a large page PDE. */
+#define CR4_PSE 0x00000010               /* CR4 bit enabling large pages. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -80,6 +90,28 @@ static inline uint32_t *pde_get_pt (uint32_t pde) {
   return ptov (pde & PTE_ADDR);
 }
 
+/* Returns true if PDE is present and maps a large page. */
+static inline bool pde_is_large (uint32_t pde) {
+  return (pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
+/* Returns a PDE that maps the large page at PAGE.
+   If WRITABLE is true then it will be writable as well.
+   If USER is true it is usable by user code, otherwise only by
+   ring 0 code. */
+static inline uint32_t pde_create_large (void *page, bool writable, bool user) {
+  ASSERT ((vtop (page) & LGPGMASK) == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0)
+         | (user ? PTE_U : 0);
+}
+
+/* Returns a pointer to the large page that PDE, which must map
+   a large page, points to. */
+static inline void *pde_get_large_page (uint32_t pde) {
+  ASSERT (pde_is_large (pde));
+  return ptov (pde & PDE_LGADDR);
+}
+
 /* Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
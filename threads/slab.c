@@ -0,0 +1,295 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches, after Bonwick's slab allocator.
+
+   malloc() rounds every request up to a power of 2 and shares
+   one lock among all objects of a size class.  An object cache
+   instead serves a single object type: each of its slabs is one
+   page from the page allocator, holding a header followed by as
+   many objects as fit at their exact size.
+
+   Free objects within a slab are chained through a link word.
+   For caches without a constructor the link overlays the start
+   of the free object; for caches with one it follows the object,
+   so that a freed object keeps its constructed state and the
+   constructor runs only when its slab is created.
+
+   On top of the slabs, each cache has a magazine: a small stack
+   of recently freed objects.  Allocation pops from the magazine
+   and freeing pushes onto it with only interrupts disabled for a
+   few instructions; the cache lock and the slab lists are
+   touched only when the magazine is empty or full. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;                     /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;           /* Owning cache. */
+    struct list_elem elem;              /* In partial or free list. */
+    size_t inuse_cnt;                   /* Objects allocated. */
+    void *free;                         /* First free object. */
+  };
+
+/* Offset of the first object in a slab. */
+#define SLAB_HDR_SIZE ROUND_UP (sizeof (struct slab), sizeof (void *))
+
+/* All object caches, for kmem_print_stats(). */
+static struct list all_caches;
+
+static void *slab_alloc (struct kmem_cache *);
+static void slab_free (struct kmem_cache *, void *);
+
+/* Initializes the object cache allocator. */
+void
+kmem_init (void)
+{
+  list_init (&all_caches);
+}
+
+/* Initializes C as a cache of SIZE-byte objects called NAME.  If
+   CTOR is nonnull, it is called on every object when its slab is
+   created, and objects must be freed in their constructed
+   state. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 kmem_ctor_func *ctor)
+{
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor == NULL)
+    {
+      c->link_ofs = 0;
+      c->obj_stride = ROUND_UP (size < sizeof (void *) ? sizeof (void *)
+                                : size, sizeof (void *));
+    }
+  else
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->obj_stride = c->link_ofs + sizeof (void *);
+    }
+  ASSERT (c->obj_stride <= PGSIZE - SLAB_HDR_SIZE);
+  c->objs_per_slab = (PGSIZE - SLAB_HDR_SIZE) / c->obj_stride;
+
+  lock_init (&c->lock);
+  list_init (&c->partial_slabs);
+  list_init (&c->free_slabs);
+  c->free_slab_cnt = 0;
+  c->magazine_cnt = 0;
+
+  c->alloc_cnt = c->magazine_hits = c->free_cnt = 0;
+  c->slab_cnt = c->slab_obj_cnt = 0;
+  list_push_back (&all_caches, &c->elem);
+}
+
+/* Obtains and returns a new object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  void *obj = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  c->alloc_cnt++;
+  if (c->magazine_cnt > 0)
+    {
+      obj = c->magazine[--c->magazine_cnt];
+      c->magazine_hits++;
+    }
+  intr_set_level (old_level);
+
+  if (obj == NULL)
+    {
+      lock_acquire (&c->lock);
+      obj = slab_alloc (c);
+      lock_release (&c->lock);
+    }
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  enum intr_level old_level;
+
+  if (obj == NULL)
+    return;
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it must stay constructed. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  old_level = intr_disable ();
+  c->free_cnt++;
+  if (c->magazine_cnt < KMEM_MAGAZINE_SIZE)
+    {
+      c->magazine[c->magazine_cnt++] = obj;
+      obj = NULL;
+    }
+  intr_set_level (old_level);
+
+  if (obj != NULL)
+    {
+      lock_acquire (&c->lock);
+      slab_free (c, obj);
+      lock_release (&c->lock);
+    }
+}
+
+/* Prints statistics for every object cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      size_t used_cnt = c->slab_obj_cnt - c->magazine_cnt;
+
+      printf ("Cache %s: %"PRIu64" allocs (%"PRIu64" from magazine), "
+              "%"PRIu64" frees, %zu in use, %zu slabs, %zu bytes idle\n",
+              c->name, c->alloc_cnt, c->magazine_hits, c->free_cnt,
+              used_cnt, c->slab_cnt,
+              c->slab_cnt * PGSIZE - used_cnt * c->obj_size);
+    }
+}
+
+/* Returns the free-list link of OBJ in cache C. */
+static void **
+obj_link (const struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Returns the slab that OBJ, an object of cache C, is inside. */
+static struct slab *
+obj_to_slab (const struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((pg_ofs (obj) - SLAB_HDR_SIZE) % c->obj_stride == 0);
+  return s;
+}
+
+/* Obtains a page and makes it a slab of cache C, constructing
+   its objects.  Returns the slab, or a null pointer if no page
+   is available. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->inuse_cnt = 0;
+  s->free = NULL;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + SLAB_HDR_SIZE + i * c->obj_stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Takes an object from one of C's slabs, creating a slab if none
+   has a free object.  C's lock must be held. */
+static void *
+slab_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (list_empty (&c->partial_slabs))
+    {
+      if (!list_empty (&c->free_slabs))
+        {
+          s = list_entry (list_pop_front (&c->free_slabs), struct slab, elem);
+          c->free_slab_cnt--;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            return NULL;
+        }
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+
+  s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  s->inuse_cnt++;
+  c->slab_obj_cnt++;
+
+  /* Full slabs are on no list. */
+  if (s->free == NULL)
+    list_remove (&s->elem);
+  return obj;
+}
+
+/* Returns OBJ to its slab in cache C.  A slab left with no
+   objects in use is kept if C has fewer than KMEM_FREE_SLABS of
+   them, otherwise its page is freed.  C's lock must be held. */
+static void
+slab_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = obj_to_slab (c, obj);
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (s->inuse_cnt > 0);
+
+  if (s->free == NULL)
+    list_push_front (&c->partial_slabs, &s->elem);
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  s->inuse_cnt--;
+  c->slab_obj_cnt--;
+
+  if (s->inuse_cnt == 0)
+    {
+      list_remove (&s->elem);
+      if (c->free_slab_cnt < KMEM_FREE_SLABS)
+        {
+          list_push_front (&c->free_slabs, &s->elem);
+          c->free_slab_cnt++;
+        }
+      else
+        {
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Number of freed objects an object cache keeps in its magazine. */
+#define KMEM_MAGAZINE_SIZE 32
+
+/* Number of completely free slabs an object cache keeps instead of
+   returning them to the page allocator. */
+#define KMEM_FREE_SLABS 1
+
+/* Constructor for the objects of a cache.  Called on each object
+   once, when the slab holding it is created. */
+typedef void kmem_ctor_func (void *obj);
+
+/* An object cache: allocates objects of one size from slabs, each
+   a page divided into equal-size objects.  See slab.c. */
+struct kmem_cache
+  {
+    const char *name;                   /* Name, for statistics. */
+    size_t obj_size;                    /* Object size in bytes. */
+    size_t obj_stride;                  /* Distance between objects. */
+    size_t link_ofs;                    /* Offset of free-list link. */
+    size_t objs_per_slab;               /* Objects in one slab. */
+    kmem_ctor_func *ctor;               /* Constructor, or null. */
+
+    struct lock lock;                   /* Protects the slab lists. */
+    struct list partial_slabs;          /* Slabs with free objects. */
+    struct list free_slabs;             /* Slabs with no objects in use. */
+    size_t free_slab_cnt;               /* Length of free_slabs. */
+
+    /* Recently freed objects, handed out again without taking
+       LOCK.  Protected by disabling interrupts. */
+    void *magazine[KMEM_MAGAZINE_SIZE];
+    size_t magazine_cnt;
+
+    struct list_elem elem;              /* In list of all caches. */
+
+    /* Statistics. */
+    uint64_t alloc_cnt;                 /* Objects allocated. */
+    uint64_t magazine_hits;             /* ...of which from magazine. */
+    uint64_t free_cnt;                  /* Objects freed. */
+    size_t slab_cnt;                    /* Slabs owned. */
+    size_t slab_obj_cnt;                /* Objects out of slabs. */
+  };
+
+void kmem_init (void);
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
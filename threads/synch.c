@@ -27,6 +27,7 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
@@ -114,10 +115,60 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters))
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      /* Wake the highest-priority waiter. */
+      struct list_elem *e = list_max (&sema->waiters, thread_priority_less,
+                                     NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Maximum length of a chain of lock holders that a waiting
+   thread's priority is donated along. */
+#define DONATION_DEPTH 8
+
+/* Lock profiling.
+
+   With -lockprof, every lock records its contention in the
+   profile of the code that called lock_init() for it, so that,
+   for example, all inode locks share one profile.  Profiles are
+   identified by the return address of lock_init(), which the
+   "backtrace" utility translates into a function and line. */
+bool lock_profile;
+
+/* Contention statistics for one lock_init() call site. */
+struct lock_site
+  {
+    void *caller;               /* Return address of lock_init(). */
+    long long acquires;         /* Times acquired. */
+    long long contended;        /* Times found held by another thread. */
+    uint64_t wait_cycles;       /* Total CPU cycles spent waiting. */
+    uint64_t max_hold;          /* Longest time held, in CPU cycles. */
+  };
+
+/* Profiles, in order of first use.  Locks initialized once these
+   run out are not profiled. */
+#define LOCK_SITE_CNT 128
+static struct lock_site lock_sites[LOCK_SITE_CNT];
+static size_t lock_site_cnt;
+
+static struct lock_site *lock_site_lookup (void *caller);
+static void lock_profile_acquired (struct lock *, bool contended,
+                                   uint64_t start);
+
+/* Returns the CPU's time-stamp counter.  Timer ticks are far too
+   coarse to time locks, most of which are held for well under a
+   tick. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
 }
 
 static void sema_test_helper (void *sema_);
@@ -179,12 +230,19 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->site = (lock_profile
+                ? lock_site_lookup (__builtin_return_address (0)) : NULL);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While we wait, our priority is donated to the holder, and to
+   the holder of any lock it waits for in turn, so that a
+   lower-priority holder cannot keep us waiting behind threads of
+   middling priority.  lock_release() takes the donation back.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +250,44 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool contended;
+  uint64_t start = 0;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  contended = lock->holder != NULL;
+  if (contended && lock->site != NULL)
+    start = read_tsc ();
+  if (contended && !thread_mlfqs)
+    {
+      /* Donate our priority to the holder, and on down the chain
+         of locks it is waiting for in turn. */
+      struct lock *l = lock;
+      int depth;
+
+      cur->waiting_lock = lock;
+      for (depth = 0; l != NULL && l->holder != NULL
+                      && depth < DONATION_DEPTH; depth++)
+        {
+          if (l->holder->priority >= cur->priority)
+            break;
+          thread_donate_priority (l->holder, cur->priority);
+          l = l->holder->waiting_lock;
+        }
+    }
+
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->held_locks, &lock->elem);
+  if (lock->site != NULL)
+    lock_profile_acquired (lock, contended, start);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,14 +299,22 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+      if (lock->site != NULL)
+        lock_profile_acquired (lock, false, 0);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -228,11 +326,27 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  /* Give up the priority donated through LOCK before waking the
+     next holder, which may then preempt us. */
+  old_level = intr_disable ();
+  if (lock->site != NULL)
+    {
+      uint64_t hold = read_tsc () - lock->acquire_tsc;
+      if (hold > lock->site->max_hold)
+        lock->site->max_hold = hold;
+    }
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  if (!thread_mlfqs)
+    thread_update_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -245,14 +359,387 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
+
+/* Returns the profile for locks initialized by CALLER, creating
+   it if necessary, or a null pointer if there is no room for
+   another. */
+static struct lock_site *
+lock_site_lookup (void *caller)
+{
+  struct lock_site *site = NULL;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < lock_site_cnt; i++)
+    if (lock_sites[i].caller == caller)
+      {
+        site = &lock_sites[i];
+        break;
+      }
+  if (site == NULL && lock_site_cnt < LOCK_SITE_CNT)
+    {
+      site = &lock_sites[lock_site_cnt++];
+      site->caller = caller;
+    }
+  intr_set_level (old_level);
+  return site;
+}
+
+/* Records that the current thread just acquired LOCK, which is
+   profiled.  If CONTENDED, the thread had to wait for it since
+   time-stamp counter value START.  Interrupts must be off. */
+static void
+lock_profile_acquired (struct lock *lock, bool contended, uint64_t start)
+{
+  struct lock_site *site = lock->site;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->acquire_tsc = read_tsc ();
+  site->acquires++;
+  if (contended)
+    {
+      site->contended++;
+      site->wait_cycles += lock->acquire_tsc - start;
+    }
+}
+
+/* Returns true if lock_site A was less contended than B. */
+static bool
+lock_site_less (const struct lock_site *a, const struct lock_site *b)
+{
+  if (a->contended != b->contended)
+    return a->contended < b->contended;
+  return a->wait_cycles < b->wait_cycles;
+}
+
+/* Prints lock profiles, most contended first, if -lockprof was
+   given. */
+void
+lock_print_stats (void)
+{
+  struct lock_site *sorted[LOCK_SITE_CNT];
+  enum intr_level old_level;
+  size_t cnt, i, j;
+
+  if (!lock_profile)
+    return;
+
+  /* Insertion sort. */
+  old_level = intr_disable ();
+  cnt = lock_site_cnt;
+  for (i = 0; i < cnt; i++)
+    {
+      for (j = i; j > 0 && lock_site_less (sorted[j - 1], &lock_sites[i]); j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = &lock_sites[i];
+    }
+  intr_set_level (old_level);
+
+  printf ("Locks: %zu lock_init() callers\n", cnt);
+  for (i = 0; i < cnt; i++)
+    printf ("  %p: %lld acquires, %lld contended, %"PRIu64" wait cycles, "
+            "%"PRIu64" max hold cycles\n",
+            sorted[i]->caller, sorted[i]->acquires, sorted[i]->contended,
+            sorted[i]->wait_cycles, sorted[i]->max_hold);
+}
 
+/* Initializes MUTEX.  A mutex can be held by at most a single
+   thread at any given time, and must be released by the thread
+   that acquired it, like a lock.
+
+   Releasing a lock only ups its semaphore, so the releaser, or
+   any other thread that gets to lock_acquire() before the woken
+   waiter runs, can take the lock back, and the waiter wakes only
+   to go back to sleep.  Under contention this forms a convoy of
+   threads that keep waking and sleeping.  mutex_release() instead
+   makes the waiter the holder before waking it. */
+void
+mutex_init (struct mutex *mutex)
+{
+  ASSERT (mutex != NULL);
+
+  mutex->holder = NULL;
+  list_init (&mutex->waiters);
+}
+
+/* Acquires MUTEX, sleeping until it is handed over if necessary.
+   The mutex must not already be held by the current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+mutex_acquire (struct mutex *mutex)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (mutex != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!mutex_held_by_current_thread (mutex));
+
+  old_level = intr_disable ();
+  if (mutex->holder == NULL)
+    mutex->holder = cur;
+  else
+    {
+      list_push_back (&mutex->waiters, &cur->elem);
+      thread_block ();
+    }
+  ASSERT (mutex->holder == cur);
+  intr_set_level (old_level);
+}
+
+/* Tries to acquire MUTEX and returns true if successful or false
+   on failure.  The mutex must not already be held by the current
+   thread.
+
+   This function will not sleep, so it may be called within an
+   interrupt handler. */
+bool
+mutex_try_acquire (struct mutex *mutex)
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (mutex != NULL);
+  ASSERT (!mutex_held_by_current_thread (mutex));
+
+  old_level = intr_disable ();
+  success = mutex->holder == NULL;
+  if (success)
+    mutex->holder = thread_current ();
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Releases MUTEX, which must be owned by the current thread,
+   handing it to the highest-priority waiter, if any.
+
+   An interrupt handler cannot acquire a mutex, so it does not
+   make sense to try to release a mutex within an interrupt
+   handler. */
+void
+mutex_release (struct mutex *mutex)
+{
+  enum intr_level old_level;
+
+  ASSERT (mutex != NULL);
+  ASSERT (mutex_held_by_current_thread (mutex));
+
+  old_level = intr_disable ();
+  if (!list_empty (&mutex->waiters))
+    {
+      struct list_elem *e = list_max (&mutex->waiters, thread_priority_less,
+                                     NULL);
+      list_remove (e);
+      mutex->holder = list_entry (e, struct thread, elem);
+      thread_unblock (mutex->holder);
+    }
+  else
+    mutex->holder = NULL;
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Returns true if the current thread holds MUTEX, false
+   otherwise. */
+bool
+mutex_held_by_current_thread (const struct mutex *mutex)
+{
+  ASSERT (mutex != NULL);
+
+  return mutex->holder == thread_current ();
+}
+
+/* A thread waiting for a rwlock. */
+struct rwlock_waiter
+  {
+    struct list_elem elem;              /* List element. */
+    struct thread *thread;              /* Waiting thread. */
+    bool writer;                        /* Waiting to write? */
+  };
+
+static void rwlock_grant (struct rwlock *);
+static void rwlock_wait (struct rwlock *, bool writer);
+
+/* Initializes RW, with writer preference unless FAIR is true. */
+void
+rwlock_init (struct rwlock *rw, bool fair)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  rw->waiting_writers = 0;
+  list_init (&rw->waiters);
+  rw->fair = fair;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it,
+   and, with writer preference, none is waiting for it, or in a
+   fair rwlock, until the threads that arrived earlier have had
+   it.  A thread may not acquire RW for reading more than once.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_read_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL
+      && (rw->fair ? list_empty (&rw->waiters) : rw->waiting_writers == 0))
+    rw->readers++;
+  else
+    rwlock_wait (rw, false);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   The last reader out hands RW to the next writer. */
+void
+rwlock_read_release (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  if (--rw->readers == 0)
+    rwlock_grant (rw);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  The rwlock must not already be held by the current
+   thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_write_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0 && list_empty (&rw->waiters))
+    rw->writer = thread_current ();
+  else
+    {
+      rw->waiting_writers++;
+      rwlock_wait (rw, true);
+    }
+  ASSERT (rw->writer == thread_current ());
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing,
+   and hands it to the next writer or readers. */
+void
+rwlock_write_release (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  rwlock_grant (rw);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  (Readers are not tracked individually.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Queues the current thread on RW as a reader, or as a writer if
+   WRITER is true, and sleeps until rwlock_grant() hands it RW.
+   Interrupts must be off. */
+static void
+rwlock_wait (struct rwlock *rw, bool writer)
+{
+  struct rwlock_waiter w;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  w.thread = thread_current ();
+  w.writer = writer;
+  list_push_back (&rw->waiters, &w.elem);
+  thread_block ();
+}
+
+/* Hands RW, which no writer holds, to as many waiters as can now
+   hold it: the first waiting writer, if no readers remain, or
+   else readers.  With writer preference, readers are admitted
+   only once no writer waits; in a fair rwlock, readers at the
+   front of the queue are admitted up to the first writer.  The
+   waiters become holders before they wake up.  Interrupts must
+   be off. */
+static void
+rwlock_grant (struct rwlock *rw)
+{
+  struct list_elem *e = list_begin (&rw->waiters);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (e != list_end (&rw->waiters) && rw->writer == NULL)
+    {
+      struct rwlock_waiter *w = list_entry (e, struct rwlock_waiter, elem);
+
+      if (w->writer)
+        {
+          if (rw->readers == 0)
+            {
+              list_remove (e);
+              rw->writer = w->thread;
+              rw->waiting_writers--;
+              thread_unblock (w->thread);
+            }
+          break;
+        }
+      else if (rw->fair || rw->waiting_writers == 0)
+        {
+          e = list_remove (e);
+          rw->readers++;
+          thread_unblock (w->thread);
+        }
+      else
+        e = list_next (e);
+    }
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+static bool waiter_less (const struct list_elem *,
+                         const struct list_elem *, void *aux);
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +782,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
 
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -317,8 +805,22 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters))
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      /* Wake the highest-priority waiter. */
+      struct list_elem *e = list_max (&cond->waiters, waiter_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A has a
+   lower priority than the one waiting on B. */
+static bool
+waiter_less (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED)
+{
+  return (list_entry (a, struct semaphore_elem, elem)->thread->priority
+          < list_entry (b, struct semaphore_elem, elem)->thread->priority);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore
@@ -20,15 +21,61 @@ void sema_self_test (void);
 /* Lock. */
 struct lock
   {
-    struct thread *holder;      /* Thread holding lock (for debugging). */
+    struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* In holder's held_locks list. */
+    struct lock_site *site;     /* Profile of lock_init() caller. */
+    uint64_t acquire_tsc;       /* Time-stamp counter at acquire. */
   };
 
+/* If true, locks record contention statistics.  Set by the
+   -lockprof option. */
+extern bool lock_profile;
+
 void lock_init (struct lock *);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
+
+/* Mutex.  Like a lock, but on release ownership passes straight
+   to the highest-priority waiter, so that the releasing thread
+   cannot take it back before the waiter runs.  Does not donate
+   priority. */
+struct mutex
+  {
+    struct thread *holder;      /* Thread holding mutex. */
+    struct list waiters;        /* Threads waiting for it. */
+  };
+
+void mutex_init (struct mutex *);
+void mutex_acquire (struct mutex *);
+bool mutex_try_acquire (struct mutex *);
+void mutex_release (struct mutex *);
+bool mutex_held_by_current_thread (const struct mutex *);
+
+/* Readers-writer lock.  Any number of readers, or a single
+   writer, may hold it at once.  By default, waiting writers take
+   precedence over readers, so that a steady stream of readers
+   cannot starve a writer.  A fair rwlock instead grants waiters
+   strictly in arrival order, with consecutive readers admitted
+   together. */
+struct rwlock
+  {
+    unsigned readers;           /* Threads holding it to read. */
+    struct thread *writer;      /* Thread holding it to write. */
+    unsigned waiting_writers;   /* Writers in waiters. */
+    struct list waiters;        /* Waiting threads, in arrival order. */
+    bool fair;                  /* Grant in arrival order? */
+  };
+
+void rwlock_init (struct rwlock *, bool fair);
+void rwlock_read_acquire (struct rwlock *);
+void rwlock_read_release (struct rwlock *);
+void rwlock_write_acquire (struct rwlock *);
+void rwlock_write_release (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
 
 /* Condition variable. */
 struct condition
@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -21,9 +22,14 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, with one FIFO queue per
+   priority.  Bit P of ready_mask is set if and only if
+   ready_queues[P] is nonempty, so the highest-priority ready
+   thread is found with a single find-first-set. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static size_t ready_cnt;        /* Threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -51,20 +57,39 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
-/* Scheduling. */
+/* Scheduling.  Without MLFQS, each thread's time slice adapts to
+   its behavior: it doubles, up to TIME_SLICE_MAX, each time the
+   thread uses up its slice, and halves, down to TIME_SLICE_MIN,
+   each time the thread blocks having used less than half.  So
+   CPU-bound threads switch less often, and a thread that wakes up
+   ends the slice of a running thread of equal priority at the
+   next tick. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define TIME_SLICE_MIN 2        /* Shortest adaptive slice. */
+#define TIME_SLICE_MAX 16       /* Longest adaptive slice. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static unsigned slice_ticks;    /* Length of the current slice. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* MLFQS: estimated average number of threads ready to run over
+   the past minute. */
+static fixed_point load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static int ready_max_priority (void);
+static void set_priority (struct thread *, int priority);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *, void *aux);
+static void mlfqs_update_recent_cpu (struct thread *, void *aux);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -77,7 +102,7 @@ static tid_t allocate_tid (void);
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the run queues and the tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -88,10 +113,16 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int pri;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
+  ready_mask = 0;
+  ready_cnt = 0;
+  load_avg = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -99,6 +130,8 @@ thread_init (void)
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  if (thread_mlfqs)
+    mlfqs_update_priority (initial_thread, NULL);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -135,11 +168,30 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
+  /* Enforce preemption, at the end of the time slice or by a
+     higher-priority thread. */
+  if (++thread_ticks >= slice_ticks)
+    {
+      if (!thread_mlfqs && thread_ticks >= t->time_slice
+          && t->time_slice < TIME_SLICE_MAX)
+        t->time_slice *= 2;
+      intr_yield_on_return ();
+    }
+  else if (ready_max_priority () > t->priority)
     intr_yield_on_return ();
 }
 
+/* Adds SKIPPED timer ticks to the idle time.  Called by the timer
+   for ticks that passed without an interrupt while idle. */
+void
+thread_account_idle (int64_t skipped)
+{
+  idle_ticks += skipped;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void)
@@ -160,9 +212,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3.
+   If the new thread has a higher priority than the running
+   thread, it runs before thread_create() returns.
 
    The first thread––main is the only thread that does not go through
    this procedure. That means all initialization that happens here do not
@@ -187,8 +238,17 @@ thread_create (const char *name, int priority,
      tid = TID_ERROR;
      goto done;
  }
-  /* Initialize thread. */
+  /* Initialize thread.  Under MLFQS, the new thread inherits its
+     creator's nice and recent_cpu, which set its priority. */
   init_thread (t, name, priority);
+  if (thread_mlfqs)
+    {
+      enum intr_level old_level = intr_disable ();
+      t->nice = thread_current ()->nice;
+      t->recent_cpu = thread_current ()->recent_cpu;
+      mlfqs_update_priority (t, NULL);
+      intr_set_level (old_level);
+    }
 
   // initializing pcb here cuz it's part of creation and need to return if failed
   #ifdef USERPROG
@@ -238,6 +298,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_preempt ();
 
   done:
       if (tid == TID_ERROR) {  // free created resources since creation failed
@@ -264,10 +325,17 @@ thread_create (const char *name, int priority,
 void
 thread_block (void)
 {
+  struct thread *cur = thread_current ();
+
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
-  thread_current ()->status = THREAD_BLOCKED;
+  /* A thread that blocks early gets a shorter slice next time. */
+  if (!thread_mlfqs && thread_ticks < cur->time_slice / 2
+      && cur->time_slice > TIME_SLICE_MIN)
+    cur->time_slice /= 2;
+
+  cur->status = THREAD_BLOCKED;
   schedule ();
 }
 
@@ -278,7 +346,9 @@ thread_block (void)
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  Call thread_preempt() afterward to give
+   the CPU to T if it has a higher priority.  In an interrupt
+   handler, the switch happens on return from the interrupt. */
 void
 thread_unblock (struct thread *t)
 {
@@ -288,11 +358,51 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
+  if (intr_context () && t->priority > thread_current ()->priority)
+    intr_yield_on_return ();
+
+  /* End a long slice of an equal-priority thread at the next
+     tick, so T does not wait behind it. */
+  if (!thread_mlfqs && t->priority == thread_current ()->priority
+      && slice_ticks > thread_ticks + 1)
+    slice_ticks = thread_ticks + 1;
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a ready thread has a higher priority than the
+   running thread.  Does nothing with interrupts off, so that
+   callers keep their atomicity; the next timer tick preempts the
+   thread instead. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level;
+  bool yield;
+
+  if (intr_context ())
+    return;
+
+  old_level = intr_disable ();
+  yield = (old_level == INTR_ON
+           && ready_max_priority () > thread_current ()->priority);
+  intr_set_level (old_level);
+
+  if (yield)
+    thread_yield ();
+}
+
+/* Returns true if the thread owning list element A, which must be
+   its `elem', has a lower priority than the one owning B. */
+bool
+thread_priority_less (const struct list_elem *a, const struct list_elem *b,
+                      void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->priority
+          < list_entry (b, struct thread, elem)->priority);
+}
+
 /* Returns the name of the running thread. */
 const char *
 thread_name (void)
@@ -336,6 +446,7 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  malloc_drain_magazines ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -359,7 +470,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -386,7 +497,62 @@ thread_foreach (thread_action_func *func, void *aux)
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The MLFQS scheduler sets priorities itself. */
+  if (thread_mlfqs)
+    return;
+
+  /* Donations still in effect keep the thread at least at the
+     priority of its highest waiter. */
+  old_level = intr_disable ();
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority (thread_current ());
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Raises T's effective priority to PRIORITY, if that is higher,
+   on behalf of a thread waiting for a lock that T holds.
+   Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    set_priority (t, priority);
+}
+
+/* Recomputes T's effective priority as the higher of its base
+   priority and the priorities of the threads waiting for locks
+   that T holds.  Called when T releases a lock or changes its
+   base priority.  Interrupts must be off. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct list *waiters = &list_entry (e, struct lock, elem)->semaphore.waiters;
+
+      if (!list_empty (waiters))
+        {
+          struct thread *w = list_entry (list_max (waiters,
+                                                   thread_priority_less, NULL),
+                                         struct thread, elem);
+          if (w->priority > priority)
+            priority = w->priority;
+        }
+    }
+  set_priority (t, priority);
 }
 
 /* Returns the current thread's priority. */
@@ -396,37 +562,115 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, clamped to
+   NICE_MIN...NICE_MAX, and recomputes its MLFQS priority. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur, NULL);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (fp_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (fp_mul_int (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
 }
-
+
+/* MLFQS accounting for timer tick, with T running.  T's
+   recent_cpu grows by one each tick.  Once a second, load_avg and
+   every thread's recent_cpu decay, and every priority is
+   recomputed.  In between, only T's recent_cpu changes, so every
+   fourth tick only T's priority needs recomputing. */
+static void
+mlfqs_tick (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_cnt + (t != idle_thread ? 1 : 0);
+
+      load_avg = fp_add (fp_mul (fp_div_int (fp_from_int (59), 60), load_avg),
+                         fp_mul_int (fp_div_int (fp_from_int (1), 60),
+                                     ready_threads));
+      thread_foreach (mlfqs_update_recent_cpu, NULL);
+      thread_foreach (mlfqs_update_priority, NULL);
+    }
+  else if (now % TIME_SLICE == 0)
+    mlfqs_update_priority (t, NULL);
+}
+
+/* Decays T's recent_cpu by the load average:
+   recent_cpu = (2*load_avg)/(2*load_avg + 1) * recent_cpu + nice. */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *aux UNUSED)
+{
+  fixed_point twice_load = fp_mul_int (load_avg, 2);
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fp_add_int (fp_mul (fp_div (twice_load,
+                                              fp_add_int (twice_load, 1)),
+                                      t->recent_cpu),
+                              t->nice);
+}
+
+/* Recomputes T's priority from its recent_cpu and nice value:
+   priority = PRI_MAX - recent_cpu/4 - nice*2, clamped to
+   PRI_MIN...PRI_MAX. */
+static void
+mlfqs_update_priority (struct thread *t, void *aux UNUSED)
+{
+  int priority;
+
+  if (t == idle_thread)
+    return;
+  priority = PRI_MAX - fp_to_int (fp_div_int (t->recent_cpu, 4)) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->base_priority = priority;
+  set_priority (t, priority);
+}
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -447,8 +691,13 @@ idle (void *idle_started_ UNUSED)
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_nohz_exit ();
       thread_block ();
 
+      /* Nobody else is ready: stop the periodic tick, if enabled,
+         until something is due. */
+      timer_nohz_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -512,7 +761,9 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE; // stack starts at the top of the page allocated to this thread
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  t->time_slice = TIME_SLICE;
+  list_init (&t->held_locks);
   t->magic = THREAD_MAGIC;
 
   #ifdef USERPROG
@@ -521,6 +772,9 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init(&t->file_table);
   #endif
 
+  #ifdef VM
+  list_init(&t->frame_pending);
+  #endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -549,10 +803,60 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  struct list *queue;
+  struct thread *t;
+  int pri;
+
+  if (ready_mask == 0)
     return idle_thread;
+
+  pri = ready_max_priority ();
+  queue = &ready_queues[pri];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  ready_cnt--;
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << pri);
+  return t;
+}
+
+/* Adds T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue if it is ready.  Interrupts must be off. */
+static void
+set_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      list_remove (&t->elem);
+      ready_cnt--;
+      if (list_empty (&ready_queues[t->priority]))
+        ready_mask &= ~((uint64_t) 1 << t->priority);
+      t->priority = priority;
+      ready_push (t);
+    }
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    t->priority = priority;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready. */
+static int
+ready_max_priority (void)
+{
+  return ready_mask != 0 ? 63 - __builtin_clzll (ready_mask) : -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -583,6 +887,11 @@ thread_schedule_tail (struct thread *prev)
 
   /* Start new time slice. */
   thread_ticks = 0;
+  slice_ticks = thread_mlfqs ? TIME_SLICE : cur->time_slice;
+
+  /* The idle thread may have stopped the periodic tick. */
+  if (prev == idle_thread)
+    timer_nohz_exit ();
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -5,7 +5,12 @@
 #include <list.h>
 #include <hash.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
+#include "threads/malloc.h"
 #include "userprog/process.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 struct dir;
 
@@ -29,6 +34,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS scheduler. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -92,12 +102,25 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
+    int base_priority;                  /* Priority before donation. */
+    struct list held_locks;             /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+    int nice;                           /* Niceness, for MLFQS. */
+    fixed_point recent_cpu;             /* Recent CPU use, for MLFQS. */
+    unsigned time_slice;                /* Adaptive time slice, in ticks. */
     struct list_elem allelem;           /* List element for all threads list. */
 
-    /* Shared between thread.c and synch.c. */
+    /* Shared between thread.c, synch.c and devices/timer.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /* Tick to wake up at, while
+                                           in timer_sleep(). */
+
+    /* Owned by malloc.c. */
+    struct malloc_magazine malloc_mags[MALLOC_DESC_CNT];
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -109,6 +132,13 @@ struct thread
 #ifdef VM
    struct hash sup_page_table;
    void * cur_stack_bound_addr;
+   void * frame_cache[FRAME_CACHE_SIZE];  // free user frames reserved by this thread, see vm/frame.c
+   size_t frame_cache_cnt;
+   struct list frame_pending;             // frame table entries allocated but not yet in the frame table
+   size_t resident_cnt;                   // frames mapped by this process, changed with interrupts off
+   size_t resident_limit;                 // max resident frames before it replaces its own pages; 0 for none
+   size_t wss_cnt;                        // working-set size estimate in pages, see vm/frame.c
+   size_t wss_scan;                       // working set being counted by the running sample
 #endif
 
 #ifdef FILESYS
@@ -127,6 +157,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_account_idle (int64_t skipped);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -141,6 +172,11 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
+bool thread_priority_less (const struct list_elem *,
+                           const struct list_elem *, void *aux);
+void thread_donate_priority (struct thread *, int priority);
+void thread_update_priority (struct thread *);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
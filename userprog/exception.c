@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/uaccess.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -170,6 +171,14 @@ page_fault (struct intr_frame *f)
 
   fault_page = pg_round_down(fault_addr);
   if (!not_present) {  // page present in page table
+     if (write && is_user_vaddr(fault_addr)) {
+        // a writable page mapped read-only is shared copy-on-write with a forked process, or is the zero page
+        struct sup_page_table_entry * spte = get_spte(&cur->sup_page_table, fault_page);
+        if (spte != NULL && spte->writable) {
+           if (!spte_break_cow(spte)) goto INVALID_ACCESS;
+           return;
+        }
+     }
      if (write)  goto INVALID_ACCESS;  // a write to read-only region is invalid (should be by user)
      if (user || is_kernel_vaddr(fault_addr) || fault_addr == NULL)  // a user trying to access kernel memory or a null pointer
          goto INVALID_ACCESS;
@@ -191,7 +200,10 @@ page_fault (struct intr_frame *f)
          printf("%s\n", fault_page);
          PANIC ("ERROR: !spte->present");
       }
-      if (!load_page(spte)) goto INVALID_ACCESS;  // but not an antual invalid access; caused by frame allocation or file read issue
+      if (!write && spte->page_type == ALL_ZERO) {  // reading an untouched zero page needs no frame of its own
+         if (!map_zero_page(spte)) goto INVALID_ACCESS;
+      }
+      else if (!load_page(spte)) goto INVALID_ACCESS;  // but not an antual invalid access; caused by frame allocation or file read issue
    }
 
 
@@ -199,12 +211,14 @@ page_fault (struct intr_frame *f)
    return;
 
   INVALID_ACCESS:
-  // a page fault in the kernel merely sets eax to 0xffffffff and copies its former value into eip.
-  // indicate a bug in kernel
+  // a bad user address handed to the kernel: resume at the fixup of the faulting copy (see uaccess.c)
+  // a fault in the kernel without one is a bug in kernel, and kill() panics
   if (!user) { // access by kernel
-     f->eip = (void *) f->eax;
-     f->eax = 0xffffffff;
-     return;
+     uintptr_t fixup = search_exception_table((uintptr_t) f->eip);
+     if (fixup != 0) {
+        f->eip = (void *) fixup;
+        return;
+     }
   }
 
 
@@ -41,7 +41,9 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P)
+    if (pde_is_large (*pde))
+      palloc_free_multiple (pde_get_large_page (*pde), LGPGCNT);
+    else if (*pde & PTE_P)
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -59,7 +61,10 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR lies in a large page, the PDE that maps it is
+   returned instead, since its P, W, U, A and D bits are in the
+   same places as a PTE's. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -87,6 +92,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (pde_is_large (*pde))
+    return create ? NULL : pde;
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -131,6 +138,68 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Makes sure PD has the page table that maps user virtual page
+   UPAGE, so that a later pagedir_set_page() for UPAGE cannot
+   fail.  Returns false if memory for it cannot be obtained, or if
+   UPAGE lies in a large page. */
+bool
+pagedir_reserve_page (uint32_t *pd, const void *upage)
+{
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  return lookup_page (pd, upage, true) != NULL;
+}
+
+/* Maps the 4 MB user virtual region starting at UPAGE in PD to
+   the large page at kernel virtual address KPAGE, which should
+   come from palloc_get_large().  Both must be 4 MB aligned, and
+   no part of the region may already have a page table.
+   If WRITABLE is true, the new page is read/write; otherwise it
+   is read-only.
+   Returns true if successful, false if the region is already
+   (partly) mapped.  On success PD owns KPAGE and frees it in
+   pagedir_destroy(). */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (((uintptr_t) upage & LGPGMASK) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde != 0)
+    return false;
+
+  *pde = pde_create_large (kpage, writable, true);
+  return true;
+}
+
+/* Gives page directory DST a private copy of every large page
+   mapped in user space by SRC, at the same addresses and with
+   the same permissions.  Returns true if successful, false if
+   memory ran out; pages copied so far remain owned by DST. */
+bool
+pagedir_copy_large_pages (uint32_t *dst, uint32_t *src)
+{
+  size_t i;
+
+  ASSERT (dst != init_page_dir);
+  for (i = 0; i < pd_no (PHYS_BASE); i++)
+    if (pde_is_large (src[i]))
+      {
+        void *kpage = palloc_get_large (PAL_USER);
+        if (kpage == NULL)
+          return false;
+        memcpy (kpage, pde_get_large_page (src[i]), LGPGSIZE);
+        dst[i] = pde_create_large (kpage, (src[i] & PTE_W) != 0, true);
+      }
+  return true;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -142,6 +211,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 
   ASSERT (is_user_vaddr (uaddr));
 
+  if (pde_is_large (pd[pd_no (uaddr)]))
+    return (uint8_t *) pde_get_large_page (pd[pd_no (uaddr)])
+           + ((uintptr_t) uaddr & LGPGMASK);
+
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
@@ -234,6 +307,33 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PD is
+   writable by the user.  Returns false if PD contains no PTE for
+   VPAGE. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_W) != 0;
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Used to share pages copy-on-write between
+   processes. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -22,6 +22,7 @@
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "vm/frame.h"
@@ -31,7 +32,20 @@
 
 #include "lib/log.h"
 
+/* If true, whole 4 MB aligned runs of a writable segment's zero
+   fill (typically a big BSS) are backed by large pages, see
+   load_segment. Set by the -lp kernel option.
+
+   Nothing else gets a large page: not file-backed data, not the
+   stack, and not a BSS smaller than 4 MB or one that does not
+   cover an aligned 4 MB. The user pool must also have an aligned
+   4 MB free, so most programs, the tests included, see no
+   difference with this option. */
+bool large_user_pages;
+
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool fork_file_table (struct thread *parent);
 static bool load (const char ** argv, int argc, void (**eip) (void), void **esp);
 
 /* Starts a new thread running a user program loaded from
@@ -104,6 +118,10 @@ static void start_process (void *command_) {
    bool success = false;
    struct thread *cur = thread_current();
 
+   #ifdef VM
+   cur->resident_limit = frame_resident_limit;
+   #endif
+
    /* Initialize interrupt frame and load executable. */
    memset (&if_, 0, sizeof if_);
    if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -150,6 +168,113 @@ static void start_process (void *command_) {
    NOT_REACHED ();
 }
 
+/* Hand-off between process_fork and start_fork.
+   Lives on the parent's stack; the parent waits until the child is done with it. */
+struct fork_args {
+   struct thread *parent;
+   struct intr_frame if_;              // parent's user context, resumed by the child
+   struct pcb_t *pcb;                  // child's pcb
+   bool success;
+   struct semaphore forked;            // upped by the child once the copy is finished
+};
+
+/*
+   Duplicates the current process. The child resumes from the same user
+   context F, sees 0 as the return value of fork, and shares the parent's
+   memory copy-on-write (see sup_page_table_fork).
+   Returns the child's pid, or TID_ERROR if the copy failed
+*/
+pid_t process_fork (struct intr_frame *f) {
+   struct thread *cur = thread_current();
+   struct fork_args args;
+
+   args.parent = cur;
+   args.if_ = *f;
+   args.pcb = NULL;
+   args.success = false;
+   sema_init(&args.forked, 0);
+
+   tid_t tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &args);
+   if (tid == TID_ERROR) return TID_ERROR;
+   sema_down(&args.forked);
+
+   // the child is not freed before it's waited, even if it failed
+   list_push_back(&cur->child_list, &args.pcb->elem);
+   return args.success ? tid : TID_ERROR;
+}
+
+/* Thread function for a forked child; copies the blocked parent, then
+   returns to user mode where the parent made the fork call */
+static void start_fork (void *args_) {
+   struct fork_args *args = args_;
+   struct thread *parent = args->parent;
+   struct thread *cur = thread_current();
+   struct intr_frame if_ = args->if_;
+   bool success = false;
+
+   args->pcb = cur->pcb;
+   sema_init(&cur->pcb->process_wait_sema, 0);
+   #ifdef FILESYS
+   cur->cwd = dir_reopen(parent->cwd);
+   #endif
+
+   cur->pagedir = pagedir_create ();
+   if (cur->pagedir == NULL) goto done;
+   process_activate ();
+
+   if (parent->pcb->executable != NULL) {
+      cur->pcb->executable = file_reopen(parent->pcb->executable);
+      if (cur->pcb->executable == NULL) goto done;
+      file_deny_write(cur->pcb->executable);
+   }
+   if (!fork_file_table (parent)) goto done;
+   if (!pagedir_copy_large_pages (cur->pagedir, parent->pagedir)) goto done;
+   #ifdef VM
+   cur->resident_limit = parent->resident_limit;
+   if (!sup_page_table_fork (parent, cur->pcb->executable)) goto done;
+   #endif
+   success = true;
+
+ done:
+   args->success = success;
+   sema_up(&args->forked);   // ARGS is gone after this
+   if (!success) {
+      cur->pcb->exit_status = -1;  // kernel terminate the process, so exit code is -1
+      printf("%s: exit(%d)\n", cur->name, cur->pcb->exit_status);
+      thread_exit();
+   }
+
+   if_.eax = 0;   // fork returns 0 in the child
+   asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+   NOT_REACHED ();
+}
+
+/* Copy PARENT's open files into the current process, keeping fds and positions */
+static bool fork_file_table (struct thread *parent) {
+   struct thread *cur = thread_current();
+   struct list_elem *e;
+
+   for (e = list_begin (&parent->file_table); e != list_end (&parent->file_table); e = list_next (e)) {
+      struct file_table_entry *p = list_entry (e, struct file_table_entry, elem);
+      struct file_table_entry *fte = kmem_cache_alloc(&file_table_cache);
+      if (fte == NULL) return false;
+      fte->fd = p->fd;
+      fte->file = NULL;
+      fte->dir = NULL;
+      if (p->file != NULL) {
+         fte->file = file_reopen(p->file);
+         if (fte->file != NULL) file_seek(fte->file, file_tell(p->file));
+      }
+      else fte->dir = dir_reopen(p->dir);
+      if (fte->file == NULL && fte->dir == NULL) {
+         kmem_cache_free(&file_table_cache, fte);
+         return false;
+      }
+      list_push_back(&cur->file_table, &fte->elem);
+   }
+   return true;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -214,7 +339,7 @@ void process_exit (void) {
       struct list_elem *e = list_pop_front(&cur->file_table);
       struct file_table_entry * fte = list_entry(e, struct file_table_entry, elem);
       file_close(fte->file);
-      palloc_free_page(fte);
+      kmem_cache_free(&file_table_cache, fte);
    }
 
    cur->pcb->killed = 1;   // mark this thread killed
@@ -234,6 +359,7 @@ void process_exit (void) {
    // desctroys all supplemental page table entries, also frees all frames allocated for this process
    // the table itself will be freed when thread is freed (since it's a struct, not a pointer)
    sup_page_table_destroy(&cur->sup_page_table);
+   frame_cache_drain();
    #endif
 
    /* Destroy the current process's page directory and switch back
@@ -547,6 +673,25 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+      /*
+         Back a whole aligned 4 MB of zero fill with one large page, so a single
+         TLB entry covers it. It is allocated eagerly and never paged out, and
+         has no sup page table entries. Fall back to normal pages if no aligned
+         4 MB of user memory is free
+      */
+      if (large_user_pages && writable && page_read_bytes == 0
+          && ((uintptr_t) upage & LGPGMASK) == 0 && zero_bytes >= LGPGSIZE) {
+         uint8_t *kpage = palloc_get_large (PAL_USER | PAL_ZERO);
+         if (kpage != NULL) {
+            if (pagedir_set_large_page (cur->pagedir, upage, kpage, true)) {
+               zero_bytes -= LGPGSIZE;
+               upage += LGPGSIZE;
+               continue;
+            }
+            palloc_free_multiple (kpage, LGPGCNT);
+         }
+      }
+
       #ifdef VM
       // Lazy load
       aux.page_read_bytes = page_read_bytes;
@@ -8,6 +8,7 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "filesys/file.h"
@@ -41,8 +42,16 @@ struct file_table_entry {
    struct dir *dir;
 };
 
+/* file_table_entry objects; set up by syscall_init */
+extern struct kmem_cache file_table_cache;
+
+
+struct intr_frame;
+
+extern bool large_user_pages;
 
 tid_t process_execute (const char *cmdline);
+pid_t process_fork (struct intr_frame *f);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -16,13 +16,16 @@
 #include "devices/shutdown.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
+#include "userprog/uaccess.h"
 #include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/page.h"
 #include "filesys/filesys.h"
 #include "lib/user/syscall.h"
 
@@ -42,6 +45,7 @@ static int sys_write(int fd, const void* buffer, unsigned size);
 static void sys_seek(int fd, unsigned position);
 static unsigned sys_tell(int fd);
 static void sys_close(int fd);
+static pid_t sys_fork(struct intr_frame *f);
 
 /* Added Syscalls for Subdirectories*/
 static bool sys_chdir(const char *file);
@@ -50,14 +54,24 @@ static bool sys_readdir(int fd, const char *file);
 static bool sys_isdir(int fd);
 static int sys_inumber(int fd);
 
+/* Memory statistics */
+static bool sys_memstat(struct memstat *st);
+static bool sys_memlimit(unsigned pages);
+static bool sys_madvise(void *addr, unsigned length, int advice);
+static void sys_lockstats(void);
+
 /************************ Memory Access Functions ************************/
 static void user_mem_read(void* dest_addr, void* uaddr, size_t size);
-static int user_mem_read_byte(const uint8_t *uaddr);
-static bool user_mem_write_byte(uint8_t *dest, uint8_t byte);
 static void invalid_user_access(void);
-static void verify_string(const uint8_t *ptr);
-static void verify_dest(void *dest, unsigned size);
+static char *copy_in_string(const char *ustr);
+static void check_user_buffer(const void *buffer, unsigned size, bool write);
+static unsigned user_chunk_size(const void *buffer, unsigned size);
+static bool pin_user_buffer(const void *buffer, unsigned size, bool write);
+static void unpin_user_buffer(const void *buffer, unsigned size);
+#define PIN_CHUNK_PAGES 8   // most user pages read() and write() pin at once
 /************************ File Table Helper Functions ************************/
+struct kmem_cache file_table_cache;
+
 static struct file_table_entry* get_file_table_entry_by_fd(int fd);
 static int add_to_file_table (struct file_table_entry *fte);
 
@@ -69,6 +83,7 @@ static struct lock lock_filesys;
  */
 void syscall_init(void) {
     lock_init(&lock_filesys);
+    kmem_cache_init(&file_table_cache, "file_table_entry", sizeof(struct file_table_entry), NULL);
     intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -110,6 +125,13 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
             break;
         }
 
+            /* Clone this process. */
+        case SYS_FORK:
+        {
+            f->eax = sys_fork(f);
+            break;
+        }
+
             /* Wait for a child process to die. */
         case SYS_WAIT:
         {
@@ -261,6 +283,40 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
            f->eax = sys_inumber(fd);
            break;
         }
+        /* Reports memory usage of this process. */
+        case SYS_MEMSTAT:
+        {
+           struct memstat *st;
+           user_mem_read(&st, f->esp + 4, sizeof (st));
+           f->eax = sys_memstat(st);
+           break;
+        }
+        /* Sets the resident limit of this process. */
+        case SYS_MEMLIMIT:
+        {
+           unsigned pages;
+           user_mem_read(&pages, f->esp + 4, sizeof (pages));
+           f->eax = sys_memlimit(pages);
+           break;
+        }
+        /* Gives a paging hint for a memory range. */
+        case SYS_MADVISE:
+        {
+           void *addr;
+           unsigned length;
+           int advice;
+           user_mem_read(&addr, f->esp + 4, sizeof (addr));
+           user_mem_read(&length, f->esp + 8, sizeof (length));
+           user_mem_read(&advice, f->esp + 12, sizeof (advice));
+           f->eax = sys_madvise(addr, length, advice);
+           break;
+        }
+        /* Prints lock contention statistics. */
+        case SYS_LOCKSTATS:
+        {
+           sys_lockstats();
+           break;
+        }
      }
 
   }
@@ -306,17 +362,29 @@ void sys_exit(int status) {
  *     You must use appropriate synchronization to ensure this.
  */
 pid_t sys_exec(const char* cmdline) {
-    /* check whether cmdline is a valid address
-       since when we get cmdline, we check the pointer whose content is this
-       cmdline pointer, need to check whether the actual cmdline ptr is valid
-       will use user_mem_read here since it fullfills the need
-     */
-    verify_string(cmdline);
+    char *kcmdline = copy_in_string(cmdline);
 
     lock_acquire(&lock_filesys); // in load(), file system is used
-    pid_t pid = process_execute(cmdline);
+    pid_t pid = process_execute(kcmdline);
     lock_release(&lock_filesys);
 
+    palloc_free_page(kcmdline);
+    return pid;
+}
+
+/*
+ * pid_t sys_fork (struct intr_frame *f)
+ *     - Parameters:
+ *         - f: interrupt stack frame of the caller, resumed by the child.
+ *     - Return: the child's pid in the parent, 0 in the child, -1 if the
+ *           process could not be duplicated.
+ * Description: creates a copy of the current process. Memory is shared
+ *     copy-on-write, open files are reopened at the same positions.
+ */
+pid_t sys_fork(struct intr_frame *f) {
+    lock_acquire(&lock_filesys); // child reopens files while the parent waits
+    pid_t pid = process_fork(f);
+    lock_release(&lock_filesys);
     return pid;
 }
 
@@ -346,10 +414,11 @@ int sys_wait(pid_t pid) {
  */
 
 bool sys_create(const char* file, unsigned initial_size) {
-    verify_string(file);
+    char *kfile = copy_in_string(file);
     lock_acquire(&lock_filesys);
-    bool result = filesys_create(file, initial_size);
+    bool result = filesys_create(kfile, initial_size);
     lock_release(&lock_filesys);
+    palloc_free_page(kfile);
     return result;
 }
 
@@ -362,11 +431,11 @@ bool sys_create(const char* file, unsigned initial_size) {
  *     it is open or closed, and removing an open file does not close it.
  */
 bool sys_remove(const char* file) {
-    /*Check if filename is valid*/
-    verify_string(file);
+    char *kfile = copy_in_string(file);
     lock_acquire(&lock_filesys);
-    bool result = filesys_remove(file);
+    bool result = filesys_remove(kfile);
     lock_release(&lock_filesys);
+    palloc_free_page(kfile);
     return result;
 }
 
@@ -379,17 +448,21 @@ bool sys_remove(const char* file) {
  * Description: opens the file called file.
  */
  int sys_open(const char* path) {
-    verify_string(path);
-    struct file_table_entry *fte = palloc_get_page(0);
-    if (!fte) return -1;  // memory allocation failed
+    char *kpath = copy_in_string(path);
+    struct file_table_entry *fte = kmem_cache_alloc(&file_table_cache);
+    if (!fte) {  // memory allocation failed
+       palloc_free_page(kpath);
+       return -1;
+    }
     fte->file = NULL;
     fte->dir = NULL;
 
     lock_acquire(&lock_filesys);
-    struct file *file = filesys_open(path);
+    struct file *file = filesys_open(kpath);
+    palloc_free_page(kpath);
     if (file == NULL) {   // file not successfully opened
       lock_release(&lock_filesys);
-      palloc_free_page(fte);
+      kmem_cache_free(&file_table_cache, fte);
       return -1;
    }
 
@@ -440,30 +513,36 @@ int sys_filesize(int fd) {
  *     the keyboard using input_getc().
  */
 int sys_read(int fd, void* buffer, unsigned size) {
-   verify_dest(buffer, size);
-
-   unsigned bytes_read;
-   lock_acquire(&lock_filesys);
-   if (fd == 0) {   // read from keyboard
-      for (unsigned i=0; i<size; i++) {
-         bool retval = user_mem_write_byte(buffer, input_getc());
-         if (!retval) {
-            lock_release(&lock_filesys);
-            invalid_user_access();
-         }
+   check_user_buffer(buffer, size, true);
+
+   // pinned a chunk at a time, so the copies below cannot fault (see user_chunk_size)
+   unsigned bytes_read = 0;
+   do {
+      uint8_t *chunk = (uint8_t *) buffer + bytes_read;
+      unsigned chunk_size = user_chunk_size(chunk, size - bytes_read);
+      if (!pin_user_buffer(chunk, chunk_size, true)) break;
+
+      int cnt;
+      lock_acquire(&lock_filesys);
+      if (fd == 0) {   // read from keyboard
+         for (unsigned i=0; i<chunk_size; i++)
+            chunk[i] = input_getc();
+         cnt = chunk_size;
       }
-      bytes_read = size;
-   }
-   else {      // read from opened file
-      struct file_table_entry *fte = get_file_table_entry_by_fd(fd);
-      if (fte == NULL) {
-         lock_release(&lock_filesys);
-         return -1;  // fd is not in the current thread's file table
+      else {      // read from opened file
+         struct file_table_entry *fte = get_file_table_entry_by_fd(fd);
+         // -1 if fd is not in the current thread's file table
+         cnt = fte != NULL ? file_read (fte->file, chunk, chunk_size) : -1;
       }
-      bytes_read = file_read (fte->file, buffer, size);
-   }
-   lock_release(&lock_filesys);
-   return bytes_read;
+      lock_release(&lock_filesys);
+      unpin_user_buffer(chunk, chunk_size);
+
+      if (cnt < 0) return -1;
+      bytes_read += cnt;
+      if ((unsigned) cnt < chunk_size) return bytes_read;   // end of file
+   } while (bytes_read < size);
+   // a chunk could not be brought in: report what was read, or fail if nothing was
+   return bytes_read < size && bytes_read == 0 ? -1 : (int) bytes_read;
 }
 
 /*
@@ -479,30 +558,36 @@ int sys_read(int fd, void* buffer, unsigned size) {
  *     at least as long as size is not bigger than a few hundred bytes.
  */
 int sys_write(int fd, const void* buffer, unsigned size) {
-    verify_dest(buffer, size);
-
-    unsigned bytes_written;
-    lock_acquire(&lock_filesys);
-    if (fd == 1) {  // write to console
-        putbuf(buffer, size);
-        lock_release(&lock_filesys);
-        return size;
-    }
-    else {  // write to a file
-      struct file_table_entry *fte = get_file_table_entry_by_fd(fd);
-      if (fte == NULL) {
-         lock_release(&lock_filesys);
-         return -1;  // fd is not in the current thread's file table
+    check_user_buffer(buffer, size, false);
+
+    // pinned a chunk at a time, so the copies below cannot fault (see user_chunk_size)
+    unsigned bytes_written = 0;
+    do {
+      const uint8_t *chunk = (const uint8_t *) buffer + bytes_written;
+      unsigned chunk_size = user_chunk_size(chunk, size - bytes_written);
+      if (!pin_user_buffer(chunk, chunk_size, false)) break;
+
+      int cnt;
+      lock_acquire(&lock_filesys);
+      if (fd == 1) {  // write to console
+         putbuf((const char *) chunk, chunk_size);
+         cnt = chunk_size;
       }
-      ASSERT (fte->file == NULL || fte->dir == NULL);
-      if (fte->file == NULL) {  // directory is not allowed to be written
-         lock_release(&lock_filesys);
-         return -1;  // fd is not in the current thread's file table
+      else {  // write to a file
+         struct file_table_entry *fte = get_file_table_entry_by_fd(fd);
+         ASSERT (fte == NULL || fte->file == NULL || fte->dir == NULL);
+         // -1 if not open, or a directory, which is not allowed to be written
+         cnt = fte != NULL && fte->file != NULL ? file_write (fte->file, chunk, chunk_size) : -1;
       }
-      bytes_written = file_write (fte->file, buffer, size);
-   }
-   lock_release(&lock_filesys);
-   return bytes_written;
+      lock_release(&lock_filesys);
+      unpin_user_buffer(chunk, chunk_size);
+
+      if (cnt < 0) return -1;
+      bytes_written += cnt;
+      if ((unsigned) cnt < chunk_size) return bytes_written;   // the file cannot grow
+   } while (bytes_written < size);
+   // a chunk could not be brought in: report what was written, or fail if nothing was
+   return bytes_written < size && bytes_written == 0 ? -1 : (int) bytes_written;
 }
 
 /*
@@ -564,7 +649,7 @@ void sys_close(int fd) {
       dir_close(fte->dir);
    }
    list_remove(&fte->elem);
-   palloc_free_page(fte);
+   kmem_cache_free(&file_table_cache, fte);
 
    lock_release(&lock_filesys);
 }
@@ -574,11 +659,11 @@ Changes the current working directory of the process to dir, which may be
 relative or absolute. Returns true if successful, false on failure.
 */
 bool sys_chdir(const char *path){
-    /* Check for invalid access*/
-    verify_string(path);
+    char *kpath = copy_in_string(path);
     lock_acquire(&lock_filesys);
 
-    struct dir *dir = dir_open_path (path);
+    struct dir *dir = dir_open_path (kpath);
+    palloc_free_page(kpath);
     if(dir == NULL) {
       lock_release(&lock_filesys);
       return false;
@@ -598,12 +683,12 @@ already exist. That is, mkdir("/a/b/c") succeeds only if /a/b already
 exists and /a/b/c does not.
 */
 bool sys_mkdir(const char *dir){
-    /* Check for invalid access*/
-    verify_string(dir);
+    char *kdir = copy_in_string(dir);
     bool result;
     lock_acquire(&lock_filesys);
-    result = filesys_mkdir(dir);
+    result = filesys_mkdir(kdir);
     lock_release(&lock_filesys);
+    palloc_free_page(kdir);
     return result;
 
 }
@@ -618,6 +703,7 @@ READDIR_MAX_LEN is defined in lib/user/syscall.h. If your file system supports l
 */
 bool sys_readdir(int fd, const char *name){
     bool result;
+    char kname[READDIR_MAX_LEN + 1];
     struct file_table_entry* fte = get_file_table_entry_by_fd(fd);
 
     lock_acquire(&lock_filesys);
@@ -626,9 +712,10 @@ bool sys_readdir(int fd, const char *name){
         return false;
     }
 
-    result = dir_readdir(fte->dir, name);
+    result = dir_readdir(fte->dir, kname);
 
     lock_release(&lock_filesys);
+    if (result && copy_to_user((char *) name, kname, strlen(kname) + 1) != 0) invalid_user_access();
     return result;
 }
 
@@ -660,6 +747,86 @@ int sys_inumber(int fd) {
     return result;
 }
 
+/*
+ * bool sys_memstat (struct memstat *st)
+ *     - Parameters:
+ *         - st: where to store the statistics.
+ *     - Return: true if successful, false if there is no virtual memory.
+ * Description: reports how many frames the process has mapped, its
+ *     working-set size as estimated from sampled accessed bits, and its
+ *     resident limit, all in pages.
+ */
+bool sys_memstat(struct memstat *st) {
+#ifdef VM
+    struct thread *cur = thread_current();
+    struct memstat kst;
+    kst.resident = cur->resident_cnt;
+    kst.working_set = cur->wss_cnt;
+    kst.resident_limit = cur->resident_limit;
+    if (copy_to_user(st, &kst, sizeof kst) != 0) invalid_user_access();
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * bool sys_memlimit (unsigned pages)
+ *     - Parameters:
+ *         - pages: max frames the process may keep mapped, or 0 for no limit.
+ * Description: once the process has PAGES frames, each new one replaces
+ *     one of its own pages rather than a page of another process.
+ */
+bool sys_memlimit(unsigned pages) {
+#ifdef VM
+    thread_current()->resident_limit = pages;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * bool sys_madvise (void *addr, unsigned length, int advice)
+ *     - Parameters:
+ *         - addr: page aligned start of the range.
+ *         - length: size of the range in bytes.
+ *         - advice: one of the MADV_* hints.
+ *     - Return: true if successful, false if the range is not page aligned,
+ *           not entirely mapped, or the hint is unknown.
+ * Description: tells the VM system how the range will be used.
+ *     SEQUENTIAL and RANDOM adjust fault-around and swap readahead for its
+ *     pages, WILLNEED loads them now, and DONTNEED frees their frames and
+ *     swap slots, so they read back zeroed or as in the executable.
+ */
+bool sys_madvise(void *addr, unsigned length, int advice) {
+    if (addr == NULL || pg_ofs(addr) != 0 || !is_user_vaddr(addr)
+        || length > (unsigned) ((uint8_t *) PHYS_BASE - (uint8_t *) addr))
+        return false;
+#ifdef VM
+    switch (advice) {
+        case MADV_NORMAL:     return sup_page_table_advise(addr, length, ADVICE_NORMAL);
+        case MADV_SEQUENTIAL: return sup_page_table_advise(addr, length, ADVICE_SEQUENTIAL);
+        case MADV_RANDOM:     return sup_page_table_advise(addr, length, ADVICE_RANDOM);
+        case MADV_WILLNEED:   return sup_page_table_advise(addr, length, ADVICE_WILLNEED);
+        case MADV_DONTNEED:   return sup_page_table_advise(addr, length, ADVICE_DONTNEED);
+        default:              return false;
+    }
+#else
+    return false;
+#endif
+}
+
+/*
+ * void sys_lockstats (void)
+ * Description: prints the lock contention report that is otherwise
+ *     printed at shutdown, or nothing unless the kernel was started
+ *     with -lockprof.
+ */
+void sys_lockstats(void) {
+    lock_print_stats();
+}
+
 
 /************************ Memory Access Functions Implementation ************************/
 
@@ -675,82 +842,66 @@ int sys_inumber(int fd) {
  *     pointer to kernel virtual address space (above PHYS_BASE).
  */
 static void user_mem_read(void* dest_addr, void* uaddr, size_t size) {
-    // uaddr must be below PHYS_BASE and must not be NULL pointer
-    if (uaddr == NULL || !is_user_vaddr(uaddr)) invalid_user_access();
-    // read
-    for (unsigned int i = 0; i < size; i++) {
-        // read a byte from memory
-        int byte_data = user_mem_read_byte(uaddr + i);
-        // if byte_data = -1, the last memory read was a segment fault
-        if (byte_data == -1) invalid_user_access();
-        // save this byte of data to destination address
-        *(uint8_t*) (dest_addr + i) = byte_data & 0xFF;
-    }
+    if (copy_from_user(dest_addr, uaddr, size) != 0) invalid_user_access();
 }
 
-/**********************************************************
-The main reason to have both verify_string and verify_dest
-is that one applies to KNOWN number of consecutive addresses
-the other does not, so have to look for the null terminator
-**********************************************************/
-
 /*
-check if the provided char pointer is a valid
-every char in string must be in user space, and must be in a page thats mapped
- */
-static void verify_string(const uint8_t *ptr) {
-    if (ptr == NULL || !is_user_vaddr(ptr)) invalid_user_access();
-
-    while (true) {
-        char byte = user_mem_read_byte(ptr);
-        if (byte == -1) invalid_user_access();
-        else if (byte == '\0') return;
-        ptr++;
+   copy the string at user address USTR into a new page, which the caller frees
+   with palloc_free_page; kills the process if it is not valid user memory,
+   or does not fit in a page with its null terminator
+*/
+static char *copy_in_string(const char *ustr) {
+    char *kstr = palloc_get_page(0);
+    if (kstr == NULL) sys_exit(-1);   // no memory to even look at the argument
+    if (strncpy_from_user(kstr, ustr, PGSIZE) < 0) {
+        palloc_free_page(kstr);
+        invalid_user_access();
     }
+    return kstr;
 }
 
 /*
-   helper function for syscalls that writes to a user address
-   check if the SIZE addresses starting at DEST are all valid to write
+   helper functions for syscalls that hand a user buffer to the file system
+   check_user_buffer kills the process unless the SIZE bytes at BUFFER are all
+   valid user memory (writable for WRITE)
 */
-static void verify_dest(void *dest, unsigned size) {
-   for (unsigned i=0; i<size; i++) {
-      if (dest == NULL || !is_user_vaddr(dest)) invalid_user_access();
-      int byte_data = user_mem_read_byte(dest + i);
-      if (byte_data == -1) invalid_user_access();
-   }
+static void check_user_buffer(const void *buffer, unsigned size, bool write) {
+   if (buffer == NULL) invalid_user_access();
+#ifdef VM
+   if (!user_range_mapped(buffer, size, write)) invalid_user_access();
+#else
+   if (!access_ok(buffer, size, write)) invalid_user_access();
+#endif
 }
 
 /*
- * int user_mem_read_byte (const uint8_t* uaddr)
- *     - Parameters:
- *         - uaddr: address in user space to be read.
- *     - Return: the byte value if successful, -1 if a segfault occurred.
- * Description: Reads a byte at user virtual address uaddr.
- *     uaddr must be below PHYS_BASE.
- *     uaddr points to a byte of memory.
- */
-static int user_mem_read_byte(const uint8_t* uaddr) {
-    int result;
-    asm ("movl $1f, %0; movzbl %1, %0; 1:"
-                : "=&a" (result) : "m" (*uaddr));
-    return result;
+   a buffer is pinned and copied at most PIN_CHUNK_PAGES pages at a time, so a
+   buffer bigger than the user pool cannot pin every frame. Return how many of
+   the SIZE bytes at BUFFER go in the next chunk
+*/
+static unsigned user_chunk_size(const void *buffer, unsigned size) {
+   unsigned chunk_size = PIN_CHUNK_PAGES * PGSIZE - pg_ofs(buffer);
+   return size < chunk_size ? size : chunk_size;
 }
 
 /*
- * bool user_mem_write_byte (uint8_t* dest, uint8_t byte)
- *     - Parameters:
- *         - dest_addr: destination address for writing.
- *         - byte: byte of data to be written.
- *     - Return: true if successful, false if a segfault occurred.
- * Description: writes a byte to user address dest_addr.
- *     dest_addr must be below PHYS_BASE.
- */
-static bool user_mem_write_byte(uint8_t* dest_addr, uint8_t byte) {
-    int error_code;
-    asm ("movl $1f, %0; movb %b2, %1; 1:"
-                : "=&a" (error_code), "=m" (*dest_addr) : "q" (byte));
-    return error_code != -1;
+   fault in and pin the SIZE bytes at BUFFER, already checked, (made writable for
+   WRITE), so they can be copied in bulk while lock_filesys is held. Return false
+   if they cannot be brought in because every frame is pinned.
+   Without VM nothing is evicted, so checking is enough
+*/
+static bool pin_user_buffer(const void *buffer, unsigned size, bool write) {
+#ifdef VM
+   return pin_user_range(buffer, size, write);
+#else
+   return true;
+#endif
+}
+
+static void unpin_user_buffer(const void *buffer, unsigned size) {
+#ifdef VM
+   unpin_user_range(buffer, size);
+#endif
 }
 
 /*
@@ -0,0 +1,141 @@
+#include "userprog/uaccess.h"
+#include <debug.h>
+#include <string.h>
+#include "userprog/pagedir.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Bounds of the exception table, collected by the linker from
+   the __ex_table sections (see kernel.lds.S). */
+extern const struct exception_table_entry _start_ex_table[];
+extern const struct exception_table_entry _end_ex_table[];
+
+static bool user_page_ok (const void *upage, bool write);
+static size_t copy_user_raw (void *dst, const void *src, size_t size);
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns the number of bytes that could not be copied,
+   so 0 on success. */
+size_t
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  if (!access_ok (usrc, size, false))
+    return size;
+  return copy_user_raw (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST, which must be writable.  Returns the number of bytes
+   that could not be copied, so 0 on success. */
+size_t
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  if (!access_ok (udst, size, true))
+    return size;
+  return copy_user_raw (udst, src, size);
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which holds SIZE bytes.  Returns the length of the
+   string, or -1 if it is not valid user memory or does not fit
+   in DST with its null terminator.  The string is copied a page
+   at a time, so bytes after its end may be read, but never
+   from a page the string does not reach. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t copied = 0;
+
+  while (copied < size)
+    {
+      const char *src = usrc + copied;
+      size_t chunk = PGSIZE - pg_ofs (src);
+      char *end;
+
+      if (chunk > size - copied)
+        chunk = size - copied;
+      if (!access_ok (src, chunk, false)
+          || copy_user_raw (dst + copied, src, chunk) != 0)
+        return -1;
+
+      end = memchr (dst + copied, '\0', chunk);
+      if (end != NULL)
+        return end - dst;
+      copied += chunk;
+    }
+  return -1;
+}
+
+/* Returns the address to resume at if the instruction at EIP
+   faults, or 0 if EIP has no exception table entry. */
+uintptr_t
+search_exception_table (uintptr_t eip)
+{
+  const struct exception_table_entry *e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == eip)
+      return e->fixup;
+  return 0;
+}
+
+/* Returns true if the SIZE bytes at UADDR lie in user space and
+   every page they touch belongs to the current process, false
+   otherwise.  If WRITE is true, the pages must also be
+   writable.  The pages need not be resident. */
+bool
+access_ok (const void *uaddr, size_t size, bool write)
+{
+  const uint8_t *last = (const uint8_t *) uaddr + size - 1;
+  const uint8_t *page;
+
+  if (size == 0)
+    return true;
+  if (uaddr == NULL || last < (const uint8_t *) uaddr || !is_user_vaddr (last))
+    return false;
+
+  for (page = pg_round_down (uaddr); page <= last; page += PGSIZE)
+    if (!user_page_ok (page, write))
+      return false;
+  return true;
+}
+
+/* Returns true if user page UPAGE is mapped in the current
+   process or can be paged in on access, and is writable if
+   WRITE is true. */
+static bool
+user_page_ok (const void *upage, bool write)
+{
+  struct thread *cur = thread_current ();
+
+#ifdef VM
+  struct sup_page_table_entry *spte = get_spte (&cur->sup_page_table, upage);
+  if (spte != NULL)
+    return !write || spte->writable;
+#endif
+  return (pagedir_get_page (cur->pagedir, upage) != NULL
+          && (!write || pagedir_is_writable (cur->pagedir, upage)));
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be a
+   user address that has been validated.  Pages that are not
+   resident are brought in by the page fault handler and the
+   copy continues.  A fault the handler cannot resolve resumes
+   at the fixup label, with ECX holding the bytes not yet
+   copied.  Returns that count, so 0 on success. */
+static size_t
+copy_user_raw (void *dst, const void *src, size_t size)
+{
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                ".pushsection __ex_table, \"a\"\n"
+                ".long 1b, 2b\n"
+                ".popsection"
+                : "+c" (size), "+D" (dst), "+S" (src)
+                :
+                : "memory");
+  return size;
+}
@@ -0,0 +1,30 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Copying between kernel memory and the user memory of the
+   current process.  User ranges are validated one page at a
+   time against the page directory and the supplemental page
+   table, then copied whole; a fault that cannot be resolved
+   during the copy is recovered through the exception table
+   instead of oopsing the kernel. */
+
+bool access_ok (const void *uaddr, size_t size, bool write);
+size_t copy_from_user (void *dst, const void *usrc, size_t size);
+size_t copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
+
+/* An exception table entry: if the instruction at INSN faults,
+   execution resumes at FIXUP. */
+struct exception_table_entry
+  {
+    uintptr_t insn;
+    uintptr_t fixup;
+  };
+
+uintptr_t search_exception_table (uintptr_t eip);
+
+#endif /* userprog/uaccess.h */
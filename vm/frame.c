@@ -10,30 +10,99 @@
 #include "threads/interrupt.h"
 #include "userprog/pagedir.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #include "vm/page.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#include "threads/init.h"
+#include "devices/timer.h"
+#include <round.h>
+#include <string.h>
+
+#define WSS_INTERVAL (TIMER_FREQ / 4)   // timer ticks between two working-set samples
+#define WSS_WINDOW 8                    // a page is in the working set if referenced within the last WSS_WINDOW samples
 
 struct list frame_table;
 
 static struct lock lock_frame;
+static void * zero_frame;            // shared read-only by every untouched ALL_ZERO page; never in the frame table
 static struct list_elem * cur_e;     // used for replacement clock algorithm
+static size_t frame_cnt;             // entries in frame_table
+static struct frame_table_entry ** fte_map;   // FTE of each frame, indexed by physical page number
+static struct timer wss_timer;       // fires every WSS_INTERVAL ticks to take a working-set sample
+static struct kmem_cache fte_cache;
+static struct kmem_cache sharer_cache;
 static struct frame_table_entry * get_FTE_by_frame(void *frame);
-static struct frame_table_entry * get_evict_FTE (void);
+static struct frame_table_entry * take_pending_FTE (void *frame);
+static struct frame_table_entry * get_pending_FTE (void *frame);
+static void frame_table_gather (void);
+static void frame_table_gather_thread (struct thread *t, void *aux);
+static struct frame_table_entry * get_evict_FTE (struct thread *only);
 static void _frame_free (void * frame, bool free_frame);
+static bool fte_less (struct frame_table_entry *a, struct frame_table_entry *b);
+static void * _frame_allocate(enum palloc_flags flag, void *page, bool evict, bool pinned);
+static void * frame_cache_get (void);
+static void frame_cache_put (void *frame);
+static bool frame_cache_reclaim (void);
+static void frame_cache_reclaim_thread (struct thread *t, void *reclaimed);
+static size_t evict_frames (size_t cnt, struct thread *only);
+static void remove_FTE (struct frame_table_entry *fte);
+static void remove_sharer (struct frame_table_entry *fte, struct thread *t);
+static void free_FTE (struct frame_table_entry *fte);
+static bool fte_accessed (struct frame_table_entry *fte);
+static bool fte_protected (struct frame_table_entry *fte);
+static void wss_tick (void *aux);
+static void wss_sample (void);
+static void wss_publish (struct thread *t, void *aux);
+
+size_t frame_resident_limit;         // resident limit given to new processes, in pages; 0 for none
 
 
+// a process mapping a frame
+struct frame_sharer {
+   struct thread * thread;
+   struct list_elem elem;
+};
+
 // frame table entry
 struct frame_table_entry {
    void * frame;      // pointer to the base addr of the physical frame that's being occupied
    void * page;      // virtual address (which should be at the beginning of a page) that associated with this frame
-   struct thread * thread;    // pointer to the associated process
+   struct frame_sharer owner;    // the process that allocated the frame; embedded so the common case needs no extra malloc
+   struct list sharers;          // processes mapping this frame at PAGE; more than one only after fork (copy-on-write)
+   size_t sharer_cnt;
+   unsigned pin_cnt;             // while nonzero, the frame is not evicted (frame_pin)
+   uint8_t idle;                 // working-set samples since any sharer last referenced the page, up to WSS_WINDOW
+   bool referenced;              // referenced bit cleared by the sampler but not yet seen by the clock
+   bool listed;                  // in frame_table; otherwise in its allocating thread's frame_pending list
    struct list_elem elem;
 };
 
+// slot of FRAME in fte_map
+#define FTE_SLOT(FRAME) (fte_map[vtop (FRAME) >> PGBITS])
+
+// thread of the first sharer; used where every sharer sees the same content
+#define FTE_THREAD(FTE) (list_entry (list_front (&(FTE)->sharers), struct frame_sharer, elem)->thread)
+
 void frame_table_init(void) {
    list_init(&frame_table);
    lock_init(&lock_frame);
+   kmem_cache_init(&fte_cache, "frame_table_entry", sizeof(struct frame_table_entry), NULL);
+   kmem_cache_init(&sharer_cache, "frame_sharer", sizeof(struct frame_sharer), NULL);
    cur_e = list_head(&frame_table);
+   fte_map = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, DIV_ROUND_UP(init_ram_pages * sizeof *fte_map, PGSIZE));
+   zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+   timer_setup(&wss_timer, wss_tick, NULL);
+   timer_add(&wss_timer, WSS_INTERVAL);
+}
+
+/* The frame of all zeroes, mapped read-only for reads of ALL_ZERO pages */
+void * frame_zero (void) {
+   return zero_frame;
+}
+
+bool frame_is_zero (const void * frame) {
+   return frame == zero_frame;
 }
 
 /*
@@ -44,113 +113,663 @@ are same in size) from the PHYSICAL memory, despite the naming. And in physical
 memory, there are regions dedicated for the kernel.
 */
 void * frame_allocate(enum palloc_flags flag, void *page) {
-   // create critical section
-   lock_acquire(&lock_frame);
-   // get a frame in the physical memory allocated
-   void * frame = palloc_get_page(flag);
-   if (frame == NULL) {     // frame allocation failed, swap out a frame
-      struct frame_table_entry *fte_evicted = get_evict_FTE();
-      // clears Present bit, page itself not freed. other bits are preserved (such as dirty bit)
-      pagedir_clear_page(fte_evicted->thread->pagedir, fte_evicted->page);
-      struct sup_page_table_entry * spte = get_spte (&fte_evicted->thread->sup_page_table, fte_evicted->page);
-      ASSERT(spte != NULL);
-      // In Pintos, every user virtual page is aliased to its kernel virtual page. You must manage these aliases somehow.
+   return _frame_allocate(flag, page, true, false);
+}
 
+/*
+   Same as frame_allocate, but the frame enters the frame table pinned, so it
+   cannot be evicted before the caller has filled it and mapped it. Release the
+   pin with frame_unpin once the spte points to the frame, or free it with
+   frame_free while still pinned
+*/
+void * frame_allocate_pinned(enum palloc_flags flag, void *page) {
+   return _frame_allocate(flag, page, true, true);
+}
 
-      if (!(pagedir_is_dirty(fte_evicted->thread->pagedir, fte_evicted->page) || pagedir_is_dirty(fte_evicted->thread->pagedir, fte_evicted->frame))
-            && spte->page_type == FROM_FILESYS)
-      {  // not dirty and it's from filesys
-         spte->frame = NULL;
-         spte_to_filesys (spte);
-      }
-      else { // otherwise, write the frame to swap slot
-            size_t swap_index = swap_out(fte_evicted->frame);
-            if (swap_index == SWAP_ERROR) PANIC("Error: No free swap slot");
-            spte_swap_out(spte,swap_index);
-      }
+/*
+   Same as frame_allocate_pinned, but never evicts; return NULL if there is
+   no free frame left. Used for readahead, which is only worth doing
+   when memory is not under pressure.
+*/
+void * frame_try_allocate_pinned(enum palloc_flags flag, void *page) {
+   return _frame_allocate(flag, page, false, true);
+}
+
+/*
+   Fast path: the frame comes from the current thread's frame cache, and its
+   frame table entry waits in the thread's frame_pending list until eviction or
+   the working-set sampler gathers it (frame_table_gather), so no lock is taken.
+   lock_frame is held only when user memory has run out and frames must be
+   evicted
+*/
+static void * _frame_allocate(enum palloc_flags flag, void *page, bool evict, bool pinned) {
+   ASSERT (flag & PAL_USER);
+   struct thread *cur = thread_current();
 
-      _frame_free(fte_evicted->frame, true);  // free this frame, then bring in a new frame
-      frame = palloc_get_page(flag);
-      ASSERT(frame != NULL);
+   if (cur->resident_limit != 0 && cur->resident_cnt >= cur->resident_limit) {
+      // the process is at its resident limit, so it replaces one of its own pages
+      if (!evict) return NULL;
+      lock_acquire(&lock_frame);
+      if (cur->resident_cnt >= cur->resident_limit) evict_frames(1, cur);
+      lock_release(&lock_frame);
    }
 
+   void * frame = frame_cache_get();
+   if (frame == NULL) {     // frame allocation failed, swap out a frame
+      if (!evict) return NULL;
+      lock_acquire(&lock_frame);
+      // other threads refill their caches without lock_frame, so they may take the evicted frames first.
+      // Free frames parked in threads' caches are taken back before any live page is evicted
+      while ((frame = palloc_get_page(PAL_USER)) == NULL)
+         if (!frame_cache_reclaim() && evict_frames(SWAP_CLUSTER_PAGES, NULL) == 0) break;
+      lock_release(&lock_frame);
+      if (frame == NULL) return NULL;   // every frame is pinned
+   }
+   if (flag & PAL_ZERO) memset(frame, 0, PGSIZE);
+
    // create a frame table entry
-   struct frame_table_entry *fte = (struct frame_table_entry *) malloc(sizeof(struct frame_table_entry));
+   struct frame_table_entry *fte = kmem_cache_alloc(&fte_cache);
    if (fte == NULL) {
-      lock_release(&lock_frame);
+      frame_cache_put(frame);
       return NULL;
    }
-   fte->thread = thread_current();
    fte->frame = frame;
    fte->page = page;
+   fte->owner.thread = cur;
+   list_init(&fte->sharers);
+   list_push_back(&fte->sharers, &fte->owner.elem);
+   fte->sharer_cnt = 1;
+   fte->pin_cnt = pinned ? 1 : 0;
+   fte->idle = 0;
+   fte->referenced = false;
+   fte->listed = false;
 
-   // insert entry to frame table
-   list_push_back(&frame_table, &fte->elem);
-   lock_release(&lock_frame);
+   enum intr_level old_level = intr_disable ();
+   FTE_SLOT(frame) = fte;
+   list_push_back(&cur->frame_pending, &fte->elem);
+   cur->resident_cnt++;
+   intr_set_level (old_level);
    return frame;
 }
 
+/*
+   Take a free user frame from the current thread's frame cache, refilling an
+   empty cache with FRAME_CACHE_BATCH frames from one palloc call. A cache is
+   only touched by its own thread, except by frame_cache_reclaim, so
+   disabling interrupts around it is enough; no lock is needed.
+   Return NULL if no user frame is free
+*/
+static void * frame_cache_get (void) {
+   struct thread *cur = thread_current();
+   void *frame = NULL;
+   enum intr_level old_level = intr_disable ();
+   if (cur->frame_cache_cnt > 0) frame = cur->frame_cache[--cur->frame_cache_cnt];
+   intr_set_level (old_level);
+   if (frame != NULL) return frame;
+
+   uint8_t *batch = palloc_get_multiple(PAL_USER, FRAME_CACHE_BATCH);
+   if (batch == NULL) return palloc_get_page(PAL_USER);   // memory is tight or fragmented; don't hoard
+   old_level = intr_disable ();
+   for (size_t i = FRAME_CACHE_BATCH; i > 1; i--)   // popped from the back, so hand out in address order
+      cur->frame_cache[cur->frame_cache_cnt++] = batch + (i - 1) * PGSIZE;
+   intr_set_level (old_level);
+   return batch;
+}
+
+/* Return a free user frame to the current thread's frame cache, or to palloc if the cache is full */
+static void frame_cache_put (void *frame) {
+   struct thread *cur = thread_current();
+   enum intr_level old_level = intr_disable ();
+   if (cur->frame_cache_cnt < FRAME_CACHE_SIZE) cur->frame_cache[cur->frame_cache_cnt++] = frame;
+   else palloc_free_page(frame);
+   intr_set_level (old_level);
+}
+
+/*
+   Give the frames in every thread's frame cache back to palloc, so that
+   frames parked by other, possibly blocked, threads are used before live
+   pages are evicted. Return true if any frame was reclaimed
+*/
+static bool frame_cache_reclaim (void) {
+   size_t reclaimed = 0;
+   enum intr_level old_level = intr_disable ();
+   thread_foreach(frame_cache_reclaim_thread, &reclaimed);
+   intr_set_level (old_level);
+   return reclaimed > 0;
+}
+
+static void frame_cache_reclaim_thread (struct thread *t, void *reclaimed) {
+   while (t->frame_cache_cnt > 0) {
+      palloc_free_page(t->frame_cache[--t->frame_cache_cnt]);
+      (*(size_t *) reclaimed)++;
+   }
+}
+
+/* Give every frame in the current thread's frame cache back to palloc; called when a process exits */
+void frame_cache_drain (void) {
+   size_t cnt = 0;
+   // its frames are all freed by now; shared ones were gathered at fork
+   ASSERT (list_empty(&thread_current()->frame_pending));
+   enum intr_level old_level = intr_disable ();
+   frame_cache_reclaim_thread(thread_current(), &cnt);
+   intr_set_level (old_level);
+}
+
+/*
+   Evict up to CNT frames chosen by the clock algorithm; if ONLY is not NULL,
+   only frames mapped by ONLY alone are considered.
+   Dirty victims are written to swap as one cluster of contiguous slots,
+   ordered by owner and virtual address, so pages that were neighbours
+   in a process stay neighbours on disk and can be read back together.
+   Return the number of frames evicted, 0 if every candidate is pinned
+*/
+static size_t evict_frames (size_t cnt, struct thread *only) {
+   ASSERT (lock_held_by_current_thread(&lock_frame) == true);
+   ASSERT (cnt <= SWAP_CLUSTER_PAGES);
+
+   struct frame_table_entry *victims[SWAP_CLUSTER_PAGES];
+   struct frame_table_entry *to_swap[SWAP_CLUSTER_PAGES];
+   size_t victim_cnt = 0, swap_cnt = 0;
+
+   frame_table_gather();
+
+   while (victim_cnt < cnt && !list_empty(&frame_table)) {
+      struct frame_table_entry *fte_evicted = get_evict_FTE(only);
+      if (fte_evicted == NULL) break;
+      remove_FTE(fte_evicted);   // so the clock does not pick it again within this batch
+      victims[victim_cnt++] = fte_evicted;
+
+      // clears Present bit in every process sharing the frame, page itself not freed. other bits are preserved (such as dirty bit)
+      bool dirty = false;
+      struct list_elem *e;
+      for (e = list_begin (&fte_evicted->sharers); e != list_end (&fte_evicted->sharers); e = list_next (e)) {
+         uint32_t *pd = list_entry (e, struct frame_sharer, elem)->thread->pagedir;
+         pagedir_clear_page(pd, fte_evicted->page);
+         // In Pintos, every user virtual page is aliased to its kernel virtual page. You must manage these aliases somehow.
+         dirty = dirty || pagedir_is_dirty(pd, fte_evicted->page) || pagedir_is_dirty(pd, fte_evicted->frame);
+      }
+      struct sup_page_table_entry * spte = get_spte (&FTE_THREAD(fte_evicted)->sup_page_table, fte_evicted->page);
+      ASSERT(spte != NULL);
+
+      if (!dirty && spte->page_type == FROM_FILESYS)
+      {  // not dirty and it's from filesys
+         for (e = list_begin (&fte_evicted->sharers); e != list_end (&fte_evicted->sharers); e = list_next (e)) {
+            spte = get_spte (&list_entry (e, struct frame_sharer, elem)->thread->sup_page_table, fte_evicted->page);
+            spte->frame = NULL;
+            spte_to_filesys (spte);
+         }
+      }
+      else { // otherwise, compress it in memory, or failing that write the frame to swap slot
+         size_t handle = zswap_store(fte_evicted->frame);
+         if (handle != ZSWAP_ERROR) {
+            for (e = list_begin (&fte_evicted->sharers); e != list_end (&fte_evicted->sharers); e = list_next (e)) {
+               if (e != list_begin (&fte_evicted->sharers)) zswap_dup(handle);
+               spte = get_spte (&list_entry (e, struct frame_sharer, elem)->thread->sup_page_table, fte_evicted->page);
+               spte_swap_out(spte, handle, SWAP_IN_ZSWAP);
+            }
+            continue;
+         }
+         // insertion sort by (thread, page)
+         size_t i = swap_cnt++;
+         for (; i > 0 && fte_less(fte_evicted, to_swap[i - 1]); i--)
+            to_swap[i] = to_swap[i - 1];
+         to_swap[i] = fte_evicted;
+      }
+   }
+   if (swap_cnt > 0) {
+      void *frames[SWAP_CLUSTER_PAGES];
+      for (size_t i = 0; i < swap_cnt; i++) frames[i] = to_swap[i]->frame;
+
+      size_t swap_index = swap_out_multiple(frames, swap_cnt);
+      for (size_t i = 0; i < swap_cnt; i++) {
+         size_t slot = swap_index + i;
+         if (swap_index == SWAP_ERROR) {   // no contiguous run left, fall back to single slots
+            slot = swap_out(frames[i]);
+            if (slot == SWAP_ERROR) PANIC("Error: No free swap slot");
+         }
+         struct list_elem *e;
+         for (e = list_begin (&to_swap[i]->sharers); e != list_end (&to_swap[i]->sharers); e = list_next (e)) {
+            if (e != list_begin (&to_swap[i]->sharers)) swap_dup(slot);
+            struct thread *t = list_entry (e, struct frame_sharer, elem)->thread;
+            spte_swap_out(get_spte(&t->sup_page_table, to_swap[i]->page), slot, SWAP_ON_DISK);
+         }
+      }
+   }
+
+   for (size_t i = 0; i < victim_cnt; i++) {  // free these frames, then bring in a new frame
+      palloc_free_page(victims[i]->frame);
+      free_FTE(victims[i]);
+   }
+   return victim_cnt;
+}
+
+/* Order frame table entries by owner, then by virtual address */
+static bool fte_less (struct frame_table_entry *a, struct frame_table_entry *b) {
+   struct thread *ta = FTE_THREAD(a), *tb = FTE_THREAD(b);
+   if (ta != tb) return ta < tb;
+   return a->page < b->page;
+}
+
+/*
+   Must be held around frame_share, so that no frame can be evicted
+   while a forked child copies its parent's supplemental page table.
+   Shared frames must be in frame_table, so pending entries are gathered
+*/
+void frame_table_lock (void) {
+   lock_acquire(&lock_frame);
+   frame_table_gather();
+}
+
+void frame_table_unlock (void) {
+   lock_release(&lock_frame);
+}
+
+/* Add thread T as a sharer of FRAME (copy-on-write after fork).
+   The caller maps FRAME read-only in T's page directory */
+bool frame_share (void *frame, struct thread *t) {
+   ASSERT (lock_held_by_current_thread(&lock_frame) == true);
+   struct frame_table_entry *fte = get_FTE_by_frame(frame);
+   ASSERT(fte != NULL);
+   struct frame_sharer *sharer = kmem_cache_alloc(&sharer_cache);
+   if (sharer == NULL) return false;
+   sharer->thread = t;
+   list_push_back(&fte->sharers, &sharer->elem);
+   fte->sharer_cnt++;
+   enum intr_level old_level = intr_disable ();
+   t->resident_cnt++;
+   intr_set_level (old_level);
+   return true;
+}
+
+/*
+   Handle a write to the copy-on-write page of SPTE in the current process.
+   If other processes still share the page, its content is copied to a new
+   frame and the current process switches to it; otherwise the page is simply
+   made writable again.
+   The copy frame stays pinned until it is mapped: its entry names a page the
+   current process still maps to the shared frame, so evicting it would unmap
+   the live page.
+   Return false if no frame could be allocated for the copy
+*/
+bool frame_cow_copy (struct sup_page_table_entry *spte) {
+   struct thread *cur = thread_current();
+   void *new_frame = NULL;
+
+   lock_acquire(&lock_frame);
+   while (spte->present) {    // if evicted meanwhile, the retried access faults it back in as a private page
+      struct frame_table_entry *fte = get_FTE_by_frame(spte->frame);
+      ASSERT(fte != NULL);
+      if (fte->sharer_cnt == 1) {   // last one left
+         pagedir_set_writable(cur->pagedir, spte->page, true);
+         break;
+      }
+      if (new_frame == NULL) {
+         // allocation may evict, so check the page again afterwards
+         lock_release(&lock_frame);
+         new_frame = frame_allocate_pinned(PAL_USER, spte->page);
+         if (new_frame == NULL) return false;
+         lock_acquire(&lock_frame);
+         continue;
+      }
+      memcpy(new_frame, spte->frame, PGSIZE);
+      remove_sharer(fte, cur);
+      pagedir_clear_page(cur->pagedir, spte->page);
+      bool success = pagedir_set_page(cur->pagedir, spte->page, new_frame, true);
+      ASSERT(success);   // the page table already exists
+      spte->frame = new_frame;
+      get_FTE_by_frame(new_frame)->pin_cnt--;
+      new_frame = NULL;
+      break;
+   }
+   if (new_frame != NULL) _frame_free(new_frame, true);   // still pinned, so still ours
+   lock_release(&lock_frame);
+   return true;
+}
+
+/*
+   Unmap the page of SPTE from the current process if it is resident, and free
+   its frame unless other processes still share it. A frame still in the
+   current thread's frame_pending list cannot be shared or evicted, so it is
+   freed without lock_frame; otherwise this is checked under the frame table
+   lock, so a page being evicted meanwhile is left to the eviction
+*/
+void frame_release (struct sup_page_table_entry *spte) {
+   struct thread *cur = thread_current();
+
+   enum intr_level old_level = intr_disable ();
+   struct frame_table_entry *pending = spte->present ? take_pending_FTE(spte->frame) : NULL;
+   intr_set_level (old_level);
+   if (pending != NULL) {
+      pagedir_clear_page(cur->pagedir, spte->page);
+      frame_cache_put(spte->frame);
+      kmem_cache_free(&fte_cache, pending);
+      spte->present = false;
+      spte->frame = NULL;
+      return;
+   }
+
+   lock_acquire(&lock_frame);
+   if (spte->present) {
+      pagedir_clear_page(cur->pagedir, spte->page);
+      if (!frame_is_zero(spte->frame)) {
+         struct frame_table_entry *fte = get_FTE_by_frame(spte->frame);
+         ASSERT(fte != NULL);
+         if (fte->sharer_cnt > 1) remove_sharer(fte, cur);
+         else _frame_free(spte->frame, true);
+      }
+      spte->present = false;
+      spte->frame = NULL;
+   }
+   lock_release(&lock_frame);
+}
+
+/*
+   Keep the frame of the page of SPTE, in the current process, from being evicted
+   until frame_unpin. Pins nest. Return false if the page is not resident, which
+   it may no longer be by the time the frame table lock is taken
+*/
+bool frame_pin (struct sup_page_table_entry *spte) {
+   enum intr_level old_level = intr_disable ();
+   struct frame_table_entry *pending = spte->present ? get_pending_FTE(spte->frame) : NULL;
+   if (pending != NULL) pending->pin_cnt++;
+   intr_set_level (old_level);
+   if (pending != NULL) return true;
+
+   lock_acquire(&lock_frame);
+   bool present = spte->present;
+   if (present && !frame_is_zero(spte->frame)) get_FTE_by_frame(spte->frame)->pin_cnt++;
+   lock_release(&lock_frame);
+   return present;
+}
+
+void frame_unpin (struct sup_page_table_entry *spte) {
+   enum intr_level old_level = intr_disable ();
+   struct frame_table_entry *pending = spte->present ? get_pending_FTE(spte->frame) : NULL;
+   if (pending != NULL) {
+      ASSERT(pending->pin_cnt > 0);
+      pending->pin_cnt--;
+   }
+   intr_set_level (old_level);
+   if (pending != NULL) return;
+
+   lock_acquire(&lock_frame);
+   ASSERT(spte->present);
+   if (!frame_is_zero(spte->frame)) {
+      struct frame_table_entry *fte = get_FTE_by_frame(spte->frame);
+      ASSERT(fte->pin_cnt > 0);
+      fte->pin_cnt--;
+   }
+   lock_release(&lock_frame);
+}
+
+/* Remove thread T from the sharers of FTE. The embedded owner slot is
+   refilled from another sharer so it stays at the front */
+static void remove_sharer (struct frame_table_entry *fte, struct thread *t) {
+   struct list_elem *e;
+   struct frame_sharer *sharer = NULL;
+   for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers); e = list_next (e)) {
+      sharer = list_entry (e, struct frame_sharer, elem);
+      if (sharer->thread == t) break;
+   }
+   ASSERT(e != list_end (&fte->sharers));
+
+   if (sharer == &fte->owner && fte->sharer_cnt > 1) {
+      struct frame_sharer *other = list_entry (list_back (&fte->sharers), struct frame_sharer, elem);
+      fte->owner.thread = other->thread;
+      sharer = other;
+   }
+   list_remove(&sharer->elem);
+   if (sharer != &fte->owner) kmem_cache_free(&sharer_cache, sharer);
+   fte->sharer_cnt--;
+   enum intr_level old_level = intr_disable ();   // T may change its own count without lock_frame
+   t->resident_cnt--;
+   intr_set_level (old_level);
+}
+
+/* Free FTE together with its extra sharers */
+static void free_FTE (struct frame_table_entry *fte) {
+   while (fte->sharer_cnt > 1) remove_sharer(fte, list_entry (list_back (&fte->sharers), struct frame_sharer, elem)->thread);
+   enum intr_level old_level = intr_disable ();
+   fte->owner.thread->resident_cnt--;
+   intr_set_level (old_level);
+   kmem_cache_free(&fte_cache, fte);
+}
+
 /* Free the frame and delete it from frame table */
 void frame_free(void * frame) {
+   enum intr_level old_level = intr_disable ();
+   struct frame_table_entry *pending = take_pending_FTE(frame);
+   intr_set_level (old_level);
+   if (pending != NULL) {
+      frame_cache_put(frame);
+      kmem_cache_free(&fte_cache, pending);
+      return;
+   }
+
    lock_acquire(&lock_frame);
    _frame_free(frame, true);
    lock_release(&lock_frame);
 }
 
-/* Remove frame table entry but not free the frame*/
-void frame_table_entry_delete(void * frame) {
+/*
+   Remove frame table entry but not free the frame, since it's going to be freed by pagedir_destroy
+   If other processes still share the frame, only the current process is dropped from it,
+   and PAGE is unmapped so that pagedir_destroy leaves the frame alone
+*/
+void frame_table_entry_delete(void * frame, void * page) {
+   enum intr_level old_level = intr_disable ();
+   struct frame_table_entry *pending = take_pending_FTE(frame);
+   intr_set_level (old_level);
+   if (pending != NULL) {
+      kmem_cache_free(&fte_cache, pending);
+      return;
+   }
+
    lock_acquire(&lock_frame);
-   _frame_free(frame, false);
+   struct frame_table_entry *fte = get_FTE_by_frame(frame);
+   ASSERT(fte != NULL);
+   if (fte->sharer_cnt > 1) {
+      struct thread *cur = thread_current();
+      remove_sharer(fte, cur);
+      pagedir_clear_page(cur->pagedir, page);
+   }
+   else _frame_free(frame, false);
    lock_release(&lock_frame);
 }
 
 static void _frame_free (void * frame, bool free_frame) {
    ASSERT (lock_held_by_current_thread(&lock_frame) == true);
    struct frame_table_entry *fte = get_FTE_by_frame(frame);
+   remove_FTE(fte);
+   if (free_frame) frame_cache_put(frame);
+   free_FTE(fte);
+}
+
+/*
+   Remove FTE from the frame table, moving the clock hand off it first, or
+   from the frame_pending list it still waits in. Only the latter may be done
+   without lock_frame
+*/
+static void remove_FTE (struct frame_table_entry *fte) {
+   ASSERT (!fte->listed || lock_held_by_current_thread(&lock_frame));
+   enum intr_level old_level = intr_disable ();
+   if (fte->listed) {
+      if (cur_e == &fte->elem) cur_e = list_next(cur_e);
+      frame_cnt--;
+   }
    list_remove(&fte->elem);
-   if (free_frame) palloc_free_page(frame);
-   free(fte);
+   FTE_SLOT(fte->frame) = NULL;
+   intr_set_level (old_level);
 }
 
-/* does a linear search to find the FTE associated with this frame*/
+/* Find the FTE associated with FRAME, or NULL, through fte_map */
 static struct frame_table_entry * get_FTE_by_frame(void *frame) {
+   ASSERT (lock_held_by_current_thread(&lock_frame) || intr_get_level () == INTR_OFF);
+   return FTE_SLOT(frame);
+}
+
+/*
+   Return the FTE of FRAME if it still waits in the current thread's
+   frame_pending list, otherwise NULL. Such an entry is not shared and out of
+   the clock's reach, so its owner may change it with interrupts off instead of
+   under lock_frame. Interrupts must be off
+*/
+static struct frame_table_entry * get_pending_FTE (void *frame) {
+   ASSERT (intr_get_level () == INTR_OFF);
+   if (frame == NULL || frame_is_zero(frame)) return NULL;
+   struct frame_table_entry *fte = get_FTE_by_frame(frame);
+   if (fte == NULL || fte->listed || fte->owner.thread != thread_current()) return NULL;
+   return fte;
+}
+
+/*
+   Same as get_pending_FTE, but also remove the entry from the frame_pending
+   list, for the caller to free. Interrupts must be off
+*/
+static struct frame_table_entry * take_pending_FTE (void *frame) {
+   struct frame_table_entry *fte = get_pending_FTE(frame);
+   if (fte != NULL) {
+      remove_FTE(fte);
+      thread_current()->resident_cnt--;
+   }
+   return fte;
+}
+
+/*
+   Move the entries every thread allocated since the last call from its
+   frame_pending list to the end of frame_table, where the clock and the
+   working-set sampler see them
+*/
+static void frame_table_gather (void) {
    ASSERT (lock_held_by_current_thread(&lock_frame) == true);
+   enum intr_level old_level = intr_disable ();
+   thread_foreach(frame_table_gather_thread, NULL);
+   intr_set_level (old_level);
+}
 
+static void frame_table_gather_thread (struct thread *t, void *aux UNUSED) {
    struct list_elem *e;
-   struct frame_table_entry *fte;
-   enum intr_level old_level;
+   if (list_empty(&t->frame_pending)) return;
+   for (e = list_begin (&t->frame_pending); e != list_end (&t->frame_pending); e = list_next (e)) {
+      list_entry (e, struct frame_table_entry, elem)->listed = true;
+      frame_cnt++;
+   }
+   list_splice(list_end(&frame_table), list_begin(&t->frame_pending), list_end(&t->frame_pending));
+}
 
-   old_level = intr_disable ();
+/* Whether any process sharing FTE accessed it since the last sweep; clears the accessed bits */
+static bool fte_accessed (struct frame_table_entry *fte) {
+   bool accessed = fte->referenced;   // the sampler clears the hardware bits too, and leaves what it saw here
+   struct list_elem *e;
+   fte->referenced = false;
+   for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers); e = list_next (e)) {
+      uint32_t *pd = list_entry (e, struct frame_sharer, elem)->thread->pagedir;
+      if (pagedir_is_accessed(pd, fte->page)) {
+         pagedir_set_accessed(pd, fte->page, false);
+         accessed = true;
+      }
+   }
+   if (accessed) fte->idle = 0;
+   return accessed;
+}
 
-   for (e = list_begin (&frame_table); e != list_end (&frame_table);
-        e = list_next (e))
-     {
-      fte = list_entry (e, struct frame_table_entry, elem);
-      if (fte->frame == frame) break;  // comparing the value of pointer (aka physical address), should be fine
-     }
-   intr_set_level (old_level);
-   if (e == list_end(&frame_table)) return NULL;
-   return fte;
+/*
+   Whether FTE is in the working set of every process sharing it, and none of
+   them holds more frames than its working set. The clock passes over such
+   frames, so processes that outgrow their working set are evicted first
+*/
+static bool fte_protected (struct frame_table_entry *fte) {
+   struct list_elem *e;
+   if (fte->idle >= WSS_WINDOW) return false;
+   for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers); e = list_next (e)) {
+      struct thread *t = list_entry (e, struct frame_sharer, elem)->thread;
+      if (t->resident_cnt > t->wss_cnt) return false;
+   }
+   return true;
 }
 
 /*
    determine which page to replace with clock algorithm
    did not concern dirty bit
+   Frames protected by the working-set estimate are skipped during the first
+   revolution only, so a victim is always found.
+   Pinned frames are never candidates. If ONLY is not NULL, only frames mapped
+   by ONLY alone are. NULL is returned if there is no candidate
    return the frame table entry to be replaced
 */
-static struct frame_table_entry * get_evict_FTE (void) {
+static struct frame_table_entry * get_evict_FTE (struct thread *only) {
    ASSERT(!list_empty(&frame_table));
-   if (cur_e == list_head (&frame_table))  cur_e = list_next(cur_e);  // a workaround; since cur_e can only be initialized to head
-   struct frame_table_entry *cur = list_entry (cur_e, struct frame_table_entry, elem);
-   struct thread * t = thread_current();
+   size_t steps = 0;
+   struct frame_table_entry *cur;
 
-   while (pagedir_is_accessed(t->pagedir, cur->page)) {
-      pagedir_set_accessed(t->pagedir, cur->page, false);
-      cur_e = list_next(cur_e);
-      if (cur_e == list_end(&frame_table))  cur_e = list_begin(&frame_table);
+   for (;; steps++) {
+      if (cur_e == list_head (&frame_table) || cur_e == list_end (&frame_table))
+         cur_e = list_begin(&frame_table);  // a workaround; since cur_e can only be initialized to head
       cur = list_entry (cur_e, struct frame_table_entry, elem);
+
+      bool candidate = cur->pin_cnt == 0 && (only == NULL || (cur->sharer_cnt == 1 && FTE_THREAD(cur) == only));
+      if (candidate && !fte_accessed(cur) && (steps >= frame_cnt || !fte_protected(cur))) break;
+      if (steps > 2 * frame_cnt) return NULL;   // every candidate had its second chance
+      cur_e = list_next(cur_e);
    }
    // this frame_table_entry is going to be evicted, so change cur_e (the clock ptr) to the next entry
    cur_e = list_next(cur_e);
    return cur;
 }
+
+/*
+   Timer callback: take a working-set sample and rearm. It runs in the
+   timer thread shared by every timer, so it must not block behind an
+   eviction holding lock_frame across swap I/O: the sample is skipped
+   when the lock is busy, and the next one ages the frames instead
+*/
+static void wss_tick (void *aux UNUSED) {
+   if (lock_try_acquire(&lock_frame)) {
+      wss_sample();
+      lock_release(&lock_frame);
+   }
+   timer_add(&wss_timer, WSS_INTERVAL);
+}
+
+/*
+   Harvest the accessed bits of every frame, age the frames that were not
+   referenced, and count for each process the frames in its working set,
+   that is, referenced within the last WSS_WINDOW samples. The caller
+   holds lock_frame
+*/
+static void wss_sample (void) {
+   struct list_elem *e, *s;
+   enum intr_level old_level;
+
+   frame_table_gather();
+   for (e = list_begin (&frame_table); e != list_end (&frame_table); e = list_next (e)) {
+      struct frame_table_entry *fte = list_entry (e, struct frame_table_entry, elem);
+      bool used = false;
+      for (s = list_begin (&fte->sharers); s != list_end (&fte->sharers); s = list_next (s)) {
+         uint32_t *pd = list_entry (s, struct frame_sharer, elem)->thread->pagedir;
+         if (pagedir_is_accessed(pd, fte->page)) {
+            pagedir_set_accessed(pd, fte->page, false);
+            used = true;
+         }
+      }
+      if (used) {
+         fte->idle = 0;
+         fte->referenced = true;
+      }
+      else if (fte->idle < WSS_WINDOW) fte->idle++;
+
+      if (fte->idle < WSS_WINDOW)
+         for (s = list_begin (&fte->sharers); s != list_end (&fte->sharers); s = list_next (s))
+            list_entry (s, struct frame_sharer, elem)->thread->wss_scan++;
+   }
+
+   old_level = intr_disable ();
+   thread_foreach(wss_publish, NULL);
+   intr_set_level (old_level);
+}
+
+/* Make the working set counted by the last sample visible */
+static void wss_publish (struct thread *t, void *aux UNUSED) {
+   t->wss_cnt = t->wss_scan;
+   t->wss_scan = 0;
+}
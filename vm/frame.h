@@ -3,11 +3,36 @@
 ************************************/
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
+#include <stdbool.h>
 #include "threads/palloc.h"
 
+struct thread;
+struct sup_page_table_entry;
+
+#define FRAME_CACHE_SIZE 16    // max free frames a thread keeps reserved for itself
+#define FRAME_CACHE_BATCH 8    // frames taken from palloc at once to refill an empty cache
+
 void frame_table_init(void);
 void * frame_allocate(enum palloc_flags flag, void *page);
+void * frame_allocate_pinned(enum palloc_flags flag, void *page);
+void * frame_try_allocate_pinned(enum palloc_flags flag, void *page);
 void frame_free(void * frame);
-void frame_table_entry_delete(void * frame);
+void frame_table_entry_delete(void * frame, void * page);
+void frame_cache_drain(void);
+
+extern size_t frame_resident_limit;
+void * frame_zero (void);
+bool frame_is_zero (const void * frame);
+
+// copy-on-write sharing after fork
+void frame_table_lock (void);
+void frame_table_unlock (void);
+bool frame_share (void *frame, struct thread *t);
+bool frame_cow_copy (struct sup_page_table_entry *spte);
+void frame_release (struct sup_page_table_entry *spte);
+
+// keep frames resident while the kernel accesses them
+bool frame_pin (struct sup_page_table_entry *spte);
+void frame_unpin (struct sup_page_table_entry *spte);
 
 #endif
@@ -7,21 +7,35 @@
 #include <string.h>
 #include <debug.h>
 #include "threads/palloc.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 
 
 static bool load_page_allzero (struct sup_page_table_entry * spte);
 static bool load_page_from_swapslot (struct sup_page_table_entry * spte);
 static bool load_page_from_filesys (struct sup_page_table_entry * spte);
+static void fault_around (struct sup_page_table_entry * spte);
+static void spte_discard (struct sup_page_table_entry * spte);
+static bool spte_pin (struct sup_page_table_entry * spte, bool write);
 static unsigned spt_hash_func (const struct hash_elem *pte_, void *aux UNUSED);
 static bool spt_less_func (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
 static void spt_destroy_func (struct hash_elem *spte_, void *aux UNUSED);
 
+/* Size of the window of executable pages brought in by one page fault
+   (see fault_around). 1 disables fault-around. Set by the -fa option */
+size_t fault_around_pages = FAULT_AROUND_DEFAULT;
+
+static struct kmem_cache spte_cache;   // every process's sup_page_table_entry objects
+
+void spte_cache_init(void) {
+   kmem_cache_init(&spte_cache, "spte", sizeof(struct sup_page_table_entry), NULL);
+}
+
 /*
    spt is a pre-process hash table already allocated during thread creation
 */
@@ -35,6 +49,78 @@ void sup_page_table_destroy(struct hash * spt) {
    hash_destroy(spt, spt_destroy_func);
 }
 
+/*
+   Copy PARENT's sup page table into the current (freshly forked) process.
+   Pages in memory are shared copy-on-write: both processes map the frame
+   read-only, and the first write fault gives the writer its own copy.
+   Pages in swap share the slot, pages in the executable are read from
+   EXECUTABLE, the child's own handle on it.
+   Must be called before the child's page directory is used, with PARENT blocked.
+*/
+bool sup_page_table_fork (struct thread * parent, struct file * executable) {
+   struct thread * cur = thread_current();
+   struct hash_iterator i;
+   bool success = true;
+
+   frame_table_lock();   // keep the parent's pages from being evicted while they are copied
+   hash_first(&i, &parent->sup_page_table);
+   while (success && hash_next(&i)) {
+      struct sup_page_table_entry * p = hash_entry(hash_cur(&i), struct sup_page_table_entry, elem);
+      struct sup_page_table_entry * spte = kmem_cache_alloc(&spte_cache);
+      if (spte == NULL) {
+         success = false;
+         break;
+      }
+      *spte = *p;
+      if (spte->file != NULL) spte->file = executable;
+
+      if (p->present && frame_is_zero(p->frame))
+         success = pagedir_set_page(cur->pagedir, p->page, p->frame, false);
+      else if (p->present) {
+         if (!frame_share(p->frame, cur)) {
+            kmem_cache_free(&spte_cache, spte);
+            success = false;
+            break;
+         }
+         // once shared, the spte has to be in the table so the frame is released on exit
+         success = pagedir_set_page(cur->pagedir, p->page, p->frame, false);
+         if (p->writable) pagedir_set_writable(parent->pagedir, p->page, false);
+         if (pagedir_is_dirty(parent->pagedir, p->page)) pagedir_set_dirty(cur->pagedir, p->page, true);
+      }
+      else if (p->page_type == SWAP_SLOT) {
+         if (p->swap_location == SWAP_IN_ZSWAP) zswap_dup(p->swap_index);
+         else swap_dup(p->swap_index);
+      }
+      hash_insert(&cur->sup_page_table, &spte->elem);
+   }
+   frame_table_unlock();
+   cur->cur_stack_bound_addr = parent->cur_stack_bound_addr;
+   return success;
+}
+
+/* Handle a write fault on a present page of SPTE, which is writable but
+   mapped read-only because it is shared with a forked process */
+bool spte_break_cow (struct sup_page_table_entry * spte) {
+   ASSERT(spte->writable);
+   if (frame_is_zero(spte->frame)) {   // first write to a zero page, give it a frame
+      pagedir_clear_page(thread_current()->pagedir, spte->page);
+      spte->present = false;
+      spte->frame = NULL;
+      return load_page_allzero(spte);
+   }
+   return frame_cow_copy(spte);
+}
+
+/* Map the shared zero frame read-only for a read fault on the ALL_ZERO page of SPTE.
+   The page stays ALL_ZERO; the first write fault allocates a private frame (spte_break_cow) */
+bool map_zero_page (struct sup_page_table_entry * spte) {
+   ASSERT(spte->page_type == ALL_ZERO);
+   if (!pagedir_set_page (thread_current()->pagedir, spte->page, frame_zero(), false)) return false;
+   spte->present = true;
+   spte->frame = frame_zero();
+   return true;
+}
+
 /*
    supplmental page table entry create
    virtual PAGE to physical FRAME are mapped (or FRAME not specified)
@@ -43,11 +129,13 @@ void sup_page_table_destroy(struct hash * spt) {
    SWAP_SLOT is not created, instead swapped out
 */
 struct sup_page_table_entry * spte_create_by_type(struct hash * spt, void * page, void * frame, enum page_type_t page_type, void * aux) {
-   struct sup_page_table_entry * spte = (struct sup_page_table_entry *) malloc(sizeof(struct sup_page_table_entry));
+   struct sup_page_table_entry * spte = kmem_cache_alloc(&spte_cache);
    if (spte == NULL) return NULL;
 
    spte->page = page;
    spte->frame = frame;
+   spte->file = NULL;
+   spte->advice = ADVICE_NORMAL;
 
    spte->page_type = page_type;
    switch (page_type) {
@@ -88,18 +176,19 @@ struct sup_page_table_entry * spte_create_by_type(struct hash * spt, void * page
    }
    struct hash_elem * retval = hash_insert(spt, &spte->elem);
    if (retval != NULL) {  // spt is already in the hash table
-      free(spte);
+      kmem_cache_free(&spte_cache, spte);
       return NULL;
    }
    return spte;
 }
 
 
-void spte_swap_out (struct sup_page_table_entry * spte, size_t swap_index) {
+void spte_swap_out (struct sup_page_table_entry * spte, size_t swap_index, enum swap_location_t swap_location) {
    spte->page_type = SWAP_SLOT;
    spte->present = false;
    spte->frame = NULL;
    spte->swap_index = swap_index;
+   spte->swap_location = swap_location;
 }
 
 void spte_to_filesys (struct sup_page_table_entry * spte) {
@@ -174,30 +263,64 @@ static bool load_page_allzero (struct sup_page_table_entry * spte) {
 }
 
 static bool load_page_from_swapslot (struct sup_page_table_entry * spte) {
-   uint8_t *frame = frame_allocate (PAL_USER, spte->page); // allocate from user pool
+   struct thread *cur = thread_current ();
+
+   /* The frames stay pinned and unmapped until their content is read in:
+      while the sptes still say SWAP_SLOT, an evicted frame would be freed
+      under the disk read. The page tables are made beforehand, so that
+      mapping cannot fail once the swap slots are released */
+   if (!pagedir_reserve_page (cur->pagedir, spte->page)) return false;
+   uint8_t *frame = frame_allocate_pinned (PAL_USER, spte->page); // allocate from user pool
    if (frame == NULL) return false;
 
-   struct thread *cur = thread_current ();
-   // ASSERT(!pagedir_is_present(cur->pagedir, spte->page));
-   if (pagedir_set_page (cur->pagedir, spte->page, frame, spte->writable)){
-      spte->present = true;
-      spte->frame = frame;
-      spte->page_type = ON_FRAME;
-   }
+   struct sup_page_table_entry * sptes[SWAP_CLUSTER_PAGES];
+   void * frames[SWAP_CLUSTER_PAGES];
+   size_t cnt = 1;
+   sptes[0] = spte;
+   frames[0] = frame;
+   if (spte->swap_location == SWAP_IN_ZSWAP)   // no disk I/O, so nothing to read ahead
+      zswap_load(spte->swap_index, frame);
+   else if (spte->advice == ADVICE_RANDOM)
+      swap_in(spte->swap_index, frame);
    else {
-      frame_free(frame);
-      return false;
+      /* Readahead: the following virtual pages that were evicted in the same
+         cluster sit in the following slots, so bring them in with the same
+         sequential read while free frames are available */
+      for (; cnt < SWAP_CLUSTER_PAGES; cnt++) {
+         struct sup_page_table_entry * next = get_spte(&cur->sup_page_table, spte->page + cnt * PGSIZE);
+         if (next == NULL || next->page_type != SWAP_SLOT || next->swap_location != SWAP_ON_DISK
+               || next->swap_index != spte->swap_index + cnt
+               || !pagedir_reserve_page (cur->pagedir, next->page))
+            break;
+         void * next_frame = frame_try_allocate_pinned(PAL_USER, next->page);
+         if (next_frame == NULL) break;
+         sptes[cnt] = next;
+         frames[cnt] = next_frame;
+      }
+      swap_in_multiple(spte->swap_index, frames, cnt);
    }
-   swap_in(spte->swap_index, frame);  // swap in after assuring all operations succeed (since swap_in wont fail)
 
+   for (size_t i = 0; i < cnt; i++) {
+      bool success = pagedir_set_page (cur->pagedir, sptes[i]->page, frames[i], sptes[i]->writable);
+      ASSERT (success);   // the page table was reserved above
+      sptes[i]->present = true;
+      sptes[i]->frame = frames[i];
+      sptes[i]->page_type = ON_FRAME;
+      // a readahead page is not touched yet, so the clock picks it first if the guess was wrong
+      if (i > 0) pagedir_set_accessed(cur->pagedir, sptes[i]->page, false);
+      frame_unpin(sptes[i]);
+   }
    return true;
 }
 
 static bool load_page_from_filesys (struct sup_page_table_entry * spte) {
    ASSERT(spte->frame == NULL);
 
-   /* allocate a frame of memory, associate the virtual page upage to it */
-   uint8_t *frame = frame_allocate (PAL_USER, spte->page); // allocate from user pool
+   /*
+   allocate a frame of memory, associate the virtual page upage to it; it stays
+   pinned until mapped, so the clock cannot evict it while the read blocks
+   */
+   uint8_t *frame = frame_allocate_pinned (PAL_USER, spte->page); // allocate from user pool
    if (frame == NULL) return false;
 
    file_seek(spte->file, spte->file_ofs);
@@ -218,15 +341,195 @@ static bool load_page_from_filesys (struct sup_page_table_entry * spte) {
       spte->present = true;
       spte->frame = frame;
       // NOT changing page_type, only change present flag, so we still get page from FILESYS after it's evicted
+      frame_unpin(spte);
    }
    else {
       frame_free(frame);
       return false;
       // since file read always start from the specified offset, nothing to restore
    }
+   fault_around(spte);
    return true;
 }
 
+/*
+   Bring in the other pages of the fault_around_pages aligned window around SPTE
+   that come from the same segment and are not resident yet, so a program
+   starting up takes one fault per window instead of one per page.
+   Pages advised sequential get a window twice as large that starts at SPTE,
+   pages advised random none.
+   Only done while there are free frames; pages are left unaccessed so the
+   clock reclaims them first if the guess was wrong. Each frame is pinned until
+   it is mapped, as the read blocks and the clock must not evict it meanwhile
+*/
+static void fault_around (struct sup_page_table_entry * spte) {
+   size_t window = spte->advice == ADVICE_SEQUENTIAL ? 2 * fault_around_pages : fault_around_pages;
+   uint8_t *start;
+   if (window <= 1 || spte->advice == ADVICE_RANDOM) return;
+
+   struct thread *cur = thread_current ();
+   if (spte->advice == ADVICE_SEQUENTIAL) start = spte->page;
+   else start = (uint8_t *) spte->page - ((uintptr_t) pg_no(spte->page) % window) * PGSIZE;
+
+   for (size_t i = 0; i < window; i++) {
+      uint8_t *page = start + i * PGSIZE;
+      if (page == spte->page || !is_user_vaddr(page)) continue;
+      struct sup_page_table_entry * next = get_spte(&cur->sup_page_table, page);
+      // same segment: same file, contiguous in it, same permission
+      if (next == NULL || next->page_type != FROM_FILESYS || next->present
+            || next->file != spte->file || next->writable != spte->writable
+            || next->file_ofs - spte->file_ofs != (uint8_t *) next->page - (uint8_t *) spte->page)
+         continue;
+
+      uint8_t *frame = frame_try_allocate_pinned (PAL_USER, page);
+      if (frame == NULL) return;
+      if (file_read_at (next->file, frame, next->page_read_bytes, next->file_ofs) != (int) next->page_read_bytes
+            || !pagedir_set_page (cur->pagedir, page, frame, next->writable)) {
+         frame_free (frame);
+         continue;
+      }
+      memset (frame + next->page_read_bytes, 0, next->page_zero_bytes);
+      pagedir_set_accessed (cur->pagedir, page, false);
+      next->present = true;
+      next->frame = frame;
+      frame_unpin (next);
+   }
+}
+
+
+/*
+   Apply madvise ADVICE to the pages of the current process in [START, START + LENGTH).
+   Access pattern hints are recorded in each spte; WILLNEED loads the pages that
+   are not resident, DONTNEED discards them (see spte_discard).
+   Return false, changing nothing, if a page in the range is not mapped
+*/
+bool sup_page_table_advise (void * start, size_t length, enum page_advice_t advice) {
+   struct thread *cur = thread_current ();
+   uint8_t *page;
+
+   ASSERT (pg_ofs(start) == 0);
+   for (page = start; page < (uint8_t *) start + length; page += PGSIZE)
+      if (get_spte(&cur->sup_page_table, page) == NULL) return false;
+
+   for (page = start; page < (uint8_t *) start + length; page += PGSIZE) {
+      struct sup_page_table_entry * spte = get_spte(&cur->sup_page_table, page);
+      switch (advice) {
+         case ADVICE_WILLNEED:
+            // zero pages have nothing to read, they stay cheaper until touched
+            if (!spte->present && spte->page_type != ALL_ZERO && !load_page(spte)) return false;
+            break;
+         case ADVICE_DONTNEED:
+            spte_discard(spte);
+            break;
+         default:
+            spte->advice = advice;
+      }
+   }
+   return true;
+}
+
+/*
+   Throw away the content of the page of SPTE, freeing its frame (or dropping this
+   process from a shared one) and its swap slot. The next access reads it from its
+   file again, or gets a zeroed page
+*/
+static void spte_discard (struct sup_page_table_entry * spte) {
+   frame_release(spte);
+   if (spte->page_type == SWAP_SLOT) {
+      if (spte->swap_location == SWAP_IN_ZSWAP) zswap_free(spte->swap_index);
+      else swap_free(spte->swap_index);
+   }
+   spte->page_type = spte->file != NULL ? FROM_FILESYS : ALL_ZERO;
+}
+
+
+/*
+   Make the pages of [BUFFER, BUFFER + SIZE) resident in the current process and
+   pin their frames, so the kernel can access them directly without faulting,
+   e.g. while it holds lock_filesys. With WRITE the pages are made privately
+   writable too. Pages without an spte that are mapped anyway are large pages,
+   which are never evicted.
+   Return false, with nothing left pinned, if part of the range is not mapped,
+   not writable for WRITE, or cannot be brought in because every frame is pinned.
+   Callers pin a few pages at a time, after checking the whole range with
+   user_range_mapped
+*/
+bool pin_user_range (const void * buffer, size_t size, bool write) {
+   struct thread *cur = thread_current ();
+   if (size == 0) return true;
+
+   uint8_t *first = pg_round_down(buffer);
+   uint8_t *last = pg_round_down((const uint8_t *) buffer + size - 1);
+   if (last < first || !is_user_vaddr(last)) return false;
+
+   for (uint8_t *page = first; page <= last; page += PGSIZE) {
+      struct sup_page_table_entry * spte = get_spte(&cur->sup_page_table, page);
+      bool pinned;
+      if (spte == NULL)
+         pinned = pagedir_get_page(cur->pagedir, page) != NULL
+                  && (!write || pagedir_is_writable(cur->pagedir, page));
+      else pinned = (!write || spte->writable) && spte_pin(spte, write);
+      if (!pinned) {
+         unpin_user_range(first, page - first);
+         return false;
+      }
+   }
+   return true;
+}
+
+/*
+   Return true if [BUFFER, BUFFER + SIZE) is all mapped in the current process,
+   and writable for WRITE, without bringing any of it in
+*/
+bool user_range_mapped (const void * buffer, size_t size, bool write) {
+   struct thread *cur = thread_current ();
+   if (size == 0) return true;
+
+   uint8_t *first = pg_round_down(buffer);
+   uint8_t *last = pg_round_down((const uint8_t *) buffer + size - 1);
+   if (last < first || !is_user_vaddr(last)) return false;
+
+   for (uint8_t *page = first; page <= last; page += PGSIZE) {
+      struct sup_page_table_entry * spte = get_spte(&cur->sup_page_table, page);
+      if (spte == NULL) {   // a large page, or nothing
+         if (pagedir_get_page(cur->pagedir, page) == NULL
+               || (write && !pagedir_is_writable(cur->pagedir, page)))
+            return false;
+      }
+      else if (write && !spte->writable) return false;
+   }
+   return true;
+}
+
+/* Undo pin_user_range for the same range */
+void unpin_user_range (const void * buffer, size_t size) {
+   struct thread *cur = thread_current ();
+   if (size == 0) return;
+
+   uint8_t *last = pg_round_down((const uint8_t *) buffer + size - 1);
+   for (uint8_t *page = pg_round_down(buffer); page <= last; page += PGSIZE) {
+      struct sup_page_table_entry * spte = get_spte(&cur->sup_page_table, page);
+      if (spte != NULL) frame_unpin(spte);
+   }
+}
+
+/* Load the page of SPTE if needed, break copy-on-write sharing for WRITE, then pin its frame */
+static bool spte_pin (struct sup_page_table_entry * spte, bool write) {
+   struct thread *cur = thread_current ();
+   for (;;) {   // each step may race with eviction, so check again until the pin holds
+      if (!spte->present) {
+         bool loaded;
+         if (!write && spte->page_type == ALL_ZERO) loaded = map_zero_page(spte);
+         else loaded = load_page(spte);
+         if (!loaded) return false;
+      }
+      else if (write && !pagedir_is_writable(cur->pagedir, spte->page)) {
+         if (!spte_break_cow(spte)) return false;
+      }
+      else if (frame_pin(spte)) return true;
+   }
+}
+
 
 static unsigned spt_hash_func (const struct hash_elem *spte_, void *aux UNUSED)
 {
@@ -244,15 +547,20 @@ static bool spt_less_func (const struct hash_elem *a_, const struct hash_elem *b
 }
 
 static void spt_destroy_func (struct hash_elem *spte_, void *aux UNUSED) {
-   const struct sup_page_table_entry *spte = hash_entry (spte_, struct sup_page_table_entry, elem);
-   if (spte->present) { // present and frame might be redundant
+   struct sup_page_table_entry *spte = hash_entry (spte_, struct sup_page_table_entry, elem);
+   if (spte->present && frame_is_zero(spte->frame)) {
+      // unmap, so pagedir_destroy does not free the shared zero frame
+      pagedir_clear_page(thread_current()->pagedir, spte->page);
+   }
+   else if (spte->present) { // present and frame might be redundant
       ASSERT(spte->page_type == ON_FRAME || spte->page_type == FROM_FILESYS);
-      frame_table_entry_delete(spte->frame);   /* Remove fte but not free the frame, since it's going to be freed by pagedir_destroy*/
+      frame_table_entry_delete(spte->frame, spte->page);   /* Remove fte but not free the frame, since it's going to be freed by pagedir_destroy*/
    }
    else if (spte->page_type == SWAP_SLOT) {
-      swap_free(spte->swap_index);
+      if (spte->swap_location == SWAP_IN_ZSWAP) zswap_free(spte->swap_index);
+      else swap_free(spte->swap_index);
    }
 
 
-   free(spte);
+   kmem_cache_free(&spte_cache, spte);
 }
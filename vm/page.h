@@ -24,6 +24,21 @@ struct sup_pte_data_filesys{
    bool writable;
 };
 
+/* where a SWAP_SLOT page is kept */
+enum swap_location_t {
+   SWAP_ON_DISK,        // slot on the BLOCK_SWAP device
+   SWAP_IN_ZSWAP        // compressed in the zswap arena
+};
+
+/* access pattern hint given by madvise; values match MADV_* in lib/user/syscall.h */
+enum page_advice_t {
+   ADVICE_NORMAL,       // default fault-around and readahead
+   ADVICE_SEQUENTIAL,   // read further ahead
+   ADVICE_RANDOM,       // no fault-around or readahead
+   ADVICE_WILLNEED,     // not kept in the spte: prefetch the pages now
+   ADVICE_DONTNEED      // not kept in the spte: discard the pages now
+};
+
 struct sup_pte_data_swapslot{
    size_t swap_index;
    bool writable;
@@ -36,19 +51,25 @@ struct sup_page_table_entry {
    bool writable;
    bool present;                 // whether this page is in physical memory
    enum page_type_t page_type;
+   enum page_advice_t advice;
 
    // filesys
-   struct file * file;
+   struct file * file;           // NULL unless the page was loaded from a file, even once it is swapped
    off_t file_ofs;
    size_t page_read_bytes;
    size_t page_zero_bytes;
 
    // swap slot
-   size_t swap_index;            // swap table index
+   size_t swap_index;            // swap table index, or zswap handle
+   enum swap_location_t swap_location;
 
    struct hash_elem elem;
 };
 
+#define FAULT_AROUND_DEFAULT 8   // pages
+extern size_t fault_around_pages;
+
+void spte_cache_init(void);
 bool sup_page_table_init(struct hash *);
 void sup_page_table_destroy(struct hash *);
 struct sup_page_table_entry * spte_create(struct hash * spt, void * page, void * frame);
@@ -56,8 +77,16 @@ struct sup_page_table_entry * spte_create_by_type(struct hash * spt, void * page
 bool load_page(struct sup_page_table_entry * spte);
 struct sup_page_table_entry * get_spte (struct hash * spt, const void * page);
 void spte_to_filesys (struct sup_page_table_entry * spte);
-void spte_swap_out (struct sup_page_table_entry * spte, size_t swap_index);
+void spte_swap_out (struct sup_page_table_entry * spte, size_t swap_index, enum swap_location_t swap_location);
 bool grow_stack (void * start_page);
+struct thread;
+bool sup_page_table_fork (struct thread * parent, struct file * executable);
+bool spte_break_cow (struct sup_page_table_entry * spte);
+bool map_zero_page (struct sup_page_table_entry * spte);
+bool sup_page_table_advise (void * start, size_t length, enum page_advice_t advice);
+bool user_range_mapped (const void * buffer, size_t size, bool write);
+bool pin_user_range (const void * buffer, size_t size, bool write);
+void unpin_user_range (const void * buffer, size_t size);
 
 
 #endif /* page_h */
@@ -7,12 +7,18 @@
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include <string.h>
 
 struct block *swap_slots;
 static struct bitmap *swap_table;
+static uint8_t *slot_ref_cnt;         // # of processes referring to each used slot (shared after fork)
+static struct lock lock_swap;         // protects swap_table, slot_ref_cnt and cluster_next
 
 static size_t SECTORS_PER_SLOT = PGSIZE / BLOCK_SECTOR_SIZE;
 static size_t SWAP_TABLE_SIZE;    // number of slots (each slot is one page)
+static size_t cluster_next;       // next-fit cursor, so clusters are laid out one after another
+static size_t swap_alloc (size_t cnt);
+static void swap_put (size_t slot_index);
 static void block_write_slot(struct block * block, size_t start_sector, void * buffer);
 static void block_read_slot(struct block * block, size_t start_sector, void * buffer);
 
@@ -29,6 +35,10 @@ bool swap_init() {
    if (swap_table == NULL) return false;  // memory allocation error
    /* initialize all bits to be true */
    bitmap_set_all (swap_table, true);
+   slot_ref_cnt = calloc (SWAP_TABLE_SIZE, sizeof *slot_ref_cnt);
+   if (slot_ref_cnt == NULL) return false;
+   lock_init(&lock_swap);
+   cluster_next = 0;
 
    return true;
 }
@@ -44,35 +54,97 @@ void swap_destroy(void) {
    Return the index of the slot written'
    Return BITMAP_ERROR if failed */
 size_t swap_out (void *frame){
+   return swap_out_multiple(&frame, 1);
+}
+
+/*
+   Write CNT frames to CNT contiguous swap slots, FRAMES[i] going to
+   slot (returned index + i), so the device is written sequentially.
+   Return the index of the first slot written
+   Return SWAP_ERROR if there is no free run of CNT slots
+*/
+size_t swap_out_multiple (void **frames, size_t cnt) {
+   ASSERT(cnt > 0);
 
-    /* Search for available region */
-    size_t slot_index = bitmap_scan(swap_table, 0, 1, true);  // start at 0, 1 consecutive page
-    if (slot_index == BITMAP_ERROR) return SWAP_ERROR;
-    /* mark used in swap table for the slot */
-    bitmap_set(swap_table, slot_index, false);
-    // write one page to the swap slots
-    block_write_slot(swap_slots, slot_index * SECTORS_PER_SLOT, frame);
+   size_t slot_index = swap_alloc(cnt);
+   if (slot_index == SWAP_ERROR) return SWAP_ERROR;
+   for (size_t i = 0; i < cnt; i++)
+      block_write_slot(swap_slots, (slot_index + i) * SECTORS_PER_SLOT, frames[i]);
 
-    return slot_index;
+   return slot_index;
 }
 
 /* Write the content from slot SLOT_INDEX to FRAME*/
 void swap_in (size_t slot_index, void * frame){
-   ASSERT(slot_index < SWAP_TABLE_SIZE);
-   ASSERT(bitmap_test(swap_table, slot_index) == false);
-
-   block_read_slot(swap_slots, slot_index * SECTORS_PER_SLOT, frame);
-   bitmap_set(swap_table, slot_index, true);
+   swap_in_multiple(slot_index, &frame, 1);
 }
 
+/* Read CNT contiguous slots starting at SLOT_INDEX into FRAMES, then
+   release the slots */
+void swap_in_multiple (size_t slot_index, void **frames, size_t cnt) {
+   ASSERT(slot_index + cnt <= SWAP_TABLE_SIZE);
+
+   for (size_t i = 0; i < cnt; i++) {
+      ASSERT(swap_slot_in_use(slot_index + i));
+      block_read_slot(swap_slots, (slot_index + i) * SECTORS_PER_SLOT, frames[i]);
+   }
+   lock_acquire(&lock_swap);
+   for (size_t i = 0; i < cnt; i++) swap_put(slot_index + i);
+   lock_release(&lock_swap);
+}
 
+/* Drop one reference to slot SLOT_INDEX; the slot is released with the last one */
 void swap_free (size_t slot_index) {
    ASSERT(slot_index < SWAP_TABLE_SIZE);
+   lock_acquire(&lock_swap);
+   swap_put(slot_index);
+   lock_release(&lock_swap);
+}
+
+/* Add a reference to slot SLOT_INDEX, for a forked process sharing the page */
+void swap_dup (size_t slot_index) {
+   ASSERT(slot_index < SWAP_TABLE_SIZE);
+   lock_acquire(&lock_swap);
    ASSERT(bitmap_test(swap_table, slot_index) == false);
-   bitmap_set(swap_table, slot_index, true);
+   ASSERT(slot_ref_cnt[slot_index] < UINT8_MAX);
+   slot_ref_cnt[slot_index]++;
+   lock_release(&lock_swap);
+}
+
+/* Whether slot SLOT_INDEX currently holds a swapped out page */
+bool swap_slot_in_use (size_t slot_index) {
+   if (slot_index >= SWAP_TABLE_SIZE) return false;
+   return bitmap_test(swap_table, slot_index) == false;
 }
 
 
+/*
+   Reserve CNT contiguous free slots and return the first one
+   Searching starts at cluster_next rather than 0, so consecutive
+   evictions land next to each other instead of refilling the first
+   hole left by a swap_in
+*/
+static size_t swap_alloc (size_t cnt) {
+   lock_acquire(&lock_swap);
+   size_t slot_index = bitmap_scan_and_flip(swap_table, cluster_next, cnt, true);
+   if (slot_index == BITMAP_ERROR)   // wrap around
+      slot_index = bitmap_scan_and_flip(swap_table, 0, cnt, true);
+   if (slot_index != BITMAP_ERROR) {
+      memset(slot_ref_cnt + slot_index, 1, cnt);
+      cluster_next = slot_index + cnt;
+      if (cluster_next >= SWAP_TABLE_SIZE) cluster_next = 0;
+   }
+   lock_release(&lock_swap);
+   return slot_index == BITMAP_ERROR ? SWAP_ERROR : slot_index;
+}
+
+static void swap_put (size_t slot_index) {
+   ASSERT (lock_held_by_current_thread(&lock_swap));
+   ASSERT(bitmap_test(swap_table, slot_index) == false);
+   ASSERT(slot_ref_cnt[slot_index] > 0);
+   if (--slot_ref_cnt[slot_index] == 0) bitmap_set(swap_table, slot_index, true);
+}
+
 /*
    Write one slot (size of a page) in the block device (aka swap slots)
 */
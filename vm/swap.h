@@ -10,12 +10,17 @@
 #include <bitmap.h>
 
 #define SWAP_ERROR  BITMAP_ERROR
+#define SWAP_CLUSTER_PAGES 8     // max number of pages written to (or read back from) swap together
 
 bool swap_init(void);
 void swap_destroy(void);
 size_t swap_out (void *frame);
 void swap_in (size_t slot_index, void * frame);
 void swap_free (size_t slot_index);
+void swap_dup (size_t slot_index);
+size_t swap_out_multiple (void **frames, size_t cnt);
+void swap_in_multiple (size_t slot_index, void **frames, size_t cnt);
+bool swap_slot_in_use (size_t slot_index);
 
 
 
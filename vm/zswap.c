@@ -0,0 +1,255 @@
+/*************************************
+ *             zswap.c               *
+ ************************************/
+
+/*
+   Compressed in-memory swap tier, sitting in front of the swap device.
+   An evicted page is compressed into an arena of kernel pool pages;
+   only pages that do not compress well, or that do not fit because
+   the arena is full, are written to the BLOCK_SWAP device.
+
+   The arena is cut into ZSWAP_CHUNK_SIZE byte chunks tracked by a
+   bitmap. A stored page takes a run of contiguous chunks:
+   a struct zswap_header, then the compressed data.
+   The handle of a stored page is the index of its first chunk.
+
+   Pages are compressed with a small LZ77 coder in the style of LZ4:
+   each sequence is a token byte (high nibble: literal count, low
+   nibble: match length - ZSWAP_MIN_MATCH, 15 meaning "more length
+   bytes follow"), the literals, then a 2-byte little endian offset.
+   The last sequence carries literals only.
+*/
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#define ZSWAP_ARENA_PAGES 32               // kernel pool pages given to the arena
+#define ZSWAP_CHUNK_SIZE 64                // allocation unit inside the arena
+#define ZSWAP_MAX_SIZE (PGSIZE / 2)        // pages compressing worse than this go to disk
+#define ZSWAP_HEADER_SIZE sizeof (struct zswap_header)
+#define ZSWAP_MIN_MATCH 4
+#define ZSWAP_HASH_BITS 10
+
+/* Header at the start of every stored page */
+struct zswap_header {
+   uint16_t len;              // compressed length
+   uint16_t ref_cnt;          // # of processes referring to it (shared after fork)
+};
+
+static uint8_t *arena;
+static struct bitmap *chunk_map;          // true = free
+static struct lock lock_zswap;            // protects arena, chunk_map and the buffers below
+
+static uint8_t compress_buf[ZSWAP_MAX_SIZE];
+static uint16_t hash_table[1 << ZSWAP_HASH_BITS];   // position + 1 of the last occurrence, 0 if none
+
+/* Statistics. */
+static unsigned long long stored_cnt;     // # of pages kept in the arena
+static unsigned long long rejected_cnt;   // # of pages passed on to the swap device
+
+static size_t lz_compress (const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap);
+static size_t lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap);
+
+
+/* Reserve the arena. zswap stays disabled (every store fails) if the kernel pool cannot spare it */
+bool zswap_init(void) {
+   lock_init(&lock_zswap);
+   arena = palloc_get_multiple(0, ZSWAP_ARENA_PAGES);
+   if (arena == NULL) return false;
+   chunk_map = bitmap_create(ZSWAP_ARENA_PAGES * PGSIZE / ZSWAP_CHUNK_SIZE);
+   if (chunk_map == NULL) {
+      palloc_free_multiple(arena, ZSWAP_ARENA_PAGES);
+      arena = NULL;
+      return false;
+   }
+   bitmap_set_all(chunk_map, true);
+   return true;
+}
+
+/*
+   Compress FRAME into the arena
+   Return the handle of the stored page
+   Return ZSWAP_ERROR if the page does not compress well or the arena is full;
+   the caller should then write the page to the swap device
+*/
+size_t zswap_store (const void *frame) {
+   if (arena == NULL) return ZSWAP_ERROR;
+
+   lock_acquire(&lock_zswap);
+   size_t len = lz_compress(frame, PGSIZE, compress_buf, sizeof compress_buf);
+   size_t handle = ZSWAP_ERROR;
+   if (len != 0) {
+      size_t chunk_cnt = DIV_ROUND_UP(ZSWAP_HEADER_SIZE + len, ZSWAP_CHUNK_SIZE);
+      size_t chunk = bitmap_scan_and_flip(chunk_map, 0, chunk_cnt, true);
+      if (chunk != BITMAP_ERROR) {
+         uint8_t *dst = arena + chunk * ZSWAP_CHUNK_SIZE;
+         struct zswap_header *h = (struct zswap_header *) dst;
+         h->len = len;
+         h->ref_cnt = 1;
+         memcpy(dst + ZSWAP_HEADER_SIZE, compress_buf, len);
+         handle = chunk;
+      }
+   }
+   if (handle == ZSWAP_ERROR) rejected_cnt++;
+   else stored_cnt++;
+   lock_release(&lock_zswap);
+   return handle;
+}
+
+/* Decompress the page stored at HANDLE into FRAME, then release it */
+void zswap_load (size_t handle, void *frame) {
+   lock_acquire(&lock_zswap);
+   const uint8_t *src = arena + handle * ZSWAP_CHUNK_SIZE;
+   size_t len = ((const struct zswap_header *) src)->len;
+   size_t out = lz_decompress(src + ZSWAP_HEADER_SIZE, len, frame, PGSIZE);
+   if (out != PGSIZE) PANIC("Error: corrupted zswap entry %zu", handle);
+   lock_release(&lock_zswap);
+   zswap_free(handle);
+}
+
+/* Drop one reference to the page stored at HANDLE; its chunks are released with the last one */
+void zswap_free (size_t handle) {
+   lock_acquire(&lock_zswap);
+   struct zswap_header *h = (struct zswap_header *) (arena + handle * ZSWAP_CHUNK_SIZE);
+   ASSERT(h->ref_cnt > 0);
+   if (--h->ref_cnt == 0) {
+      size_t chunk_cnt = DIV_ROUND_UP(ZSWAP_HEADER_SIZE + h->len, ZSWAP_CHUNK_SIZE);
+      ASSERT(bitmap_none(chunk_map, handle, chunk_cnt));
+      bitmap_set_multiple(chunk_map, handle, chunk_cnt, true);
+   }
+   lock_release(&lock_zswap);
+}
+
+/* Add a reference to the page stored at HANDLE, for a forked process sharing it */
+void zswap_dup (size_t handle) {
+   lock_acquire(&lock_zswap);
+   struct zswap_header *h = (struct zswap_header *) (arena + handle * ZSWAP_CHUNK_SIZE);
+   ASSERT(h->ref_cnt > 0 && h->ref_cnt < UINT16_MAX);
+   h->ref_cnt++;
+   lock_release(&lock_zswap);
+}
+
+void zswap_print_stats (void) {
+   if (arena == NULL) return;
+   printf ("Zswap: %llu pages compressed, %llu pages sent to swap device, %zu chunks in use\n",
+           stored_cnt, rejected_cnt, bitmap_count(chunk_map, 0, bitmap_size(chunk_map), false));
+}
+
+
+static inline uint32_t read32 (const uint8_t *p) {
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline size_t hash32 (uint32_t v) {
+   return (v * 2654435761u) >> (32 - ZSWAP_HASH_BITS);
+}
+
+/* Append a length that did not fit in a token nibble to DST. Return false on overflow */
+static bool put_length (uint8_t *dst, size_t *op, size_t dst_cap, size_t len) {
+   for (; len >= 255; len -= 255) {
+      if (*op >= dst_cap) return false;
+      dst[(*op)++] = 255;
+   }
+   if (*op >= dst_cap) return false;
+   dst[(*op)++] = len;
+   return true;
+}
+
+/* Append one sequence: literals SRC[ANCHOR, ANCHOR + LIT_LEN), then a match of
+   MATCH_LEN bytes at OFFSET back (no match if MATCH_LEN is 0) */
+static bool put_sequence (uint8_t *dst, size_t *op, size_t dst_cap, const uint8_t *lit,
+                          size_t lit_len, size_t offset, size_t match_len) {
+   if (*op >= dst_cap) return false;
+   size_t token_pos = (*op)++;
+   size_t ml = match_len == 0 ? 0 : match_len - ZSWAP_MIN_MATCH;
+   dst[token_pos] = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+
+   if (lit_len >= 15 && !put_length(dst, op, dst_cap, lit_len - 15)) return false;
+   if (*op + lit_len > dst_cap) return false;
+   memcpy(dst + *op, lit, lit_len);
+   *op += lit_len;
+
+   if (match_len == 0) return true;
+   if (*op + 2 > dst_cap) return false;
+   dst[(*op)++] = offset & 0xff;
+   dst[(*op)++] = offset >> 8;
+   if (ml >= 15 && !put_length(dst, op, dst_cap, ml - 15)) return false;
+   return true;
+}
+
+/* Compress SRC_LEN bytes at SRC into DST
+   Return the compressed size, or 0 if it would exceed DST_CAP */
+static size_t lz_compress (const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap) {
+   size_t ip = 0, anchor = 0, op = 0;
+
+   memset(hash_table, 0, sizeof hash_table);
+   while (ip + ZSWAP_MIN_MATCH <= src_len) {
+      uint32_t seq = read32(src + ip);
+      size_t h = hash32(seq);
+      size_t ref = hash_table[h];
+      hash_table[h] = ip + 1;
+      if (ref == 0 || read32(src + ref - 1) != seq) {
+         ip++;
+         continue;
+      }
+      ref--;
+
+      size_t match_len = ZSWAP_MIN_MATCH;
+      while (ip + match_len < src_len && src[ref + match_len] == src[ip + match_len])
+         match_len++;
+      if (!put_sequence(dst, &op, dst_cap, src + anchor, ip - anchor, ip - ref, match_len))
+         return 0;
+      ip += match_len;
+      anchor = ip;
+   }
+   if (!put_sequence(dst, &op, dst_cap, src + anchor, src_len - anchor, 0, 0))
+      return 0;
+   return op;
+}
+
+/* Read a length continued past a token nibble. Return false if SRC runs out */
+static bool get_length (const uint8_t *src, size_t *ip, size_t src_len, size_t *len) {
+   uint8_t b;
+   do {
+      if (*ip >= src_len) return false;
+      b = src[(*ip)++];
+      *len += b;
+   } while (b == 255);
+   return true;
+}
+
+/* Decompress SRC_LEN bytes at SRC into DST
+   Return the decompressed size, or 0 on malformed input */
+static size_t lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap) {
+   size_t ip = 0, op = 0;
+
+   while (ip < src_len) {
+      uint8_t token = src[ip++];
+      size_t lit_len = token >> 4;
+      if (lit_len == 15 && !get_length(src, &ip, src_len, &lit_len)) return 0;
+      if (ip + lit_len > src_len || op + lit_len > dst_cap) return 0;
+      memcpy(dst + op, src + ip, lit_len);
+      ip += lit_len;
+      op += lit_len;
+      if (ip == src_len) break;   // last sequence has no match
+
+      if (ip + 2 > src_len) return 0;
+      size_t offset = src[ip] | (src[ip + 1] << 8);
+      ip += 2;
+      size_t match_len = token & 0xf;
+      if (match_len == 15 && !get_length(src, &ip, src_len, &match_len)) return 0;
+      match_len += ZSWAP_MIN_MATCH;
+      if (offset == 0 || offset > op || op + match_len > dst_cap) return 0;
+      for (size_t i = 0; i < match_len; i++, op++)   // may overlap, so byte by byte
+         dst[op] = dst[op - offset];
+   }
+   return op;
+}
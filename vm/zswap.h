@@ -0,0 +1,20 @@
+/*************************************
+ *             zswap.h               *
+ ************************************/
+
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "vm/swap.h"
+
+#define ZSWAP_ERROR  SWAP_ERROR
+
+bool zswap_init(void);
+size_t zswap_store (const void *frame);
+void zswap_load (size_t handle, void *frame);
+void zswap_free (size_t handle);
+void zswap_dup (size_t handle);
+void zswap_print_stats (void);
+
+#endif /* zswap_h */